@@ -83,6 +83,7 @@ bool CogServerNode::startServers()
 	try
 	{
 		Handle h(get_handle());
+		configure(h);
 		enableNetworkServer(h);
 		enableWebServer(h);
 		enableMCPServer(h);
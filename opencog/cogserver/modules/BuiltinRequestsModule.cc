@@ -112,7 +112,7 @@ void BuiltinRequestsModule::init()
 
 // ====================================================================
 // Various flavors of closing the connection
-std::string BuiltinRequestsModule::do_exit(Request* req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_exit(Request* req, ArgSpan args)
 {
     ConsoleSocket* con = req->get_console();
     OC_ASSERT(con, "Bad request state");
@@ -126,34 +126,34 @@ std::string BuiltinRequestsModule::do_exit(Request* req, std::list<std::string>
     return "";
 }
 
-std::string BuiltinRequestsModule::do_quit(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_quit(Request *req, ArgSpan args)
 {
     return do_exit(req, args);
 }
 
-std::string BuiltinRequestsModule::do_q(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_q(Request *req, ArgSpan args)
 {
     return do_exit(req, args);
 }
 
-std::string BuiltinRequestsModule::do_ctrld(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_ctrld(Request *req, ArgSpan args)
 {
     return do_exit(req, args);
 }
 
-std::string BuiltinRequestsModule::do_iaceof(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_iaceof(Request *req, ArgSpan args)
 {
     return do_exit(req, args);
 }
 
-std::string BuiltinRequestsModule::do_dot(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_dot(Request *req, ArgSpan args)
 {
     return do_exit(req, args);
 }
 
 // ====================================================================
 // Various flavors of help
-std::string BuiltinRequestsModule::do_help(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_help(Request *req, ArgSpan args)
 {
     std::ostringstream oss;
 
@@ -186,7 +186,7 @@ std::string BuiltinRequestsModule::do_help(Request *req, std::list<std::string>
                 << cs->requestInfo(*it).description << std::endl;
         }
     } else if (args.size() == 1) {
-        const RequestClassInfo& cci = cs->requestInfo(args.front());
+        const RequestClassInfo& cci = cs->requestInfo(std::string(args.front()));
         if (cci.help != "")
             oss << cci.help << std::endl;
     } else {
@@ -196,14 +196,14 @@ std::string BuiltinRequestsModule::do_help(Request *req, std::list<std::string>
     return oss.str();
 }
 
-std::string BuiltinRequestsModule::do_h(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_h(Request *req, ArgSpan args)
 {
     return do_help(req, args);
 }
 
 // ====================================================================
 // Print general info about server.
-std::string BuiltinRequestsModule::do_stats(Request *req, std::list<std::string> args)
+std::string BuiltinRequestsModule::do_stats(Request *req, ArgSpan args)
 {
     return CogServerNodeCast(_hcsn)->display_stats();
 }
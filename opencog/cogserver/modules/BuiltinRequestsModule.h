@@ -33,62 +33,62 @@ private:
 
     Factory<ShutdownRequest, Request>     shutdownFactory;
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "exit", do_exit,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "exit", do_exit,
        "Close the shell connection",
        "Usage: exit\n\n"
        "Close the shell TCP/IP connection.\n",
-       false, true)
+       false, true, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "quit", do_quit,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "quit", do_quit,
        "Close the shell connection",
        "Usage: quit\n\n"
        "Close the shell TCP/IP connection.\n",
-       false, false)
+       false, false, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "q", do_q,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "q", do_q,
        "Close the shell connection",
        "Usage: q\n\n"
        "Close the shell TCP/IP connection.\n",
-       false, true)
+       false, true, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "", do_ctrld,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "", do_ctrld,
        "Close the shell connection",
        "Usage: ^D\n\n"
        "Close the shell TCP/IP connection.\n",
-       false, true)
+       false, true, true)
 
     // This is the RFC 1184 Telnet encoding of EOF.
     static constexpr char iaceof[3] = {(char)255, (char)236, 0};
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, iaceof, do_iaceof,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, iaceof, do_iaceof,
        "Close the shell connection",
        "Usage: ^D\n\n"
        "Close the shell TCP/IP connection.\n",
-       false, true)
+       false, true, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, ".", do_dot,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, ".", do_dot,
        "Close the shell connection",
        "Usage: .\n\n"
        "Close the shell TCP/IP connection.\n",
-       false, true)
+       false, true, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "help", do_help,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "help", do_help,
        "List the available commands; print help for a specific command",
        "Usage: help [<command>]\n\n"
        "If no command is specified, then print a menu of commands.\n"
        "Otherwise, print verbose help for the indicated command.\n",
-       false, false)
+       false, false, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "h", do_h,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "h", do_h,
        "List the available commands; print help for a specific command",
        "Usage: h [<command>]\n\n"
        "If no command is specified, then print a menu of commands.\n"
        "Otherwise, print verbose help for the indicated command.\n",
-       false, true)
+       false, true, true)
 
-DECLARE_CMD_REQUEST(BuiltinRequestsModule, "stats", do_stats,
+DECLARE_FAST_CMD_REQUEST(BuiltinRequestsModule, "stats", do_stats,
        "Print some diagnostic statistics about the server.",
        "Usage: stats\n\n" + CogServer::stats_legend(),
-       false, false)
+       false, false, true)
 
 public:
     static const char* id();
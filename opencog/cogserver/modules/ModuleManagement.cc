@@ -22,7 +22,8 @@ ListModulesRequest::info(void)
         "list",
         "List the currently loaded cogserver modules",
         "Usage: list\n\n"
-        "List modules currently loaded into the cogserver.\n"
+        "List modules currently loaded into the cogserver.\n",
+        false, false, true
     );
     return _cci;
 }
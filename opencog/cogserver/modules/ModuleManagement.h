@@ -23,6 +23,7 @@ public:                                                               \
     static const RequestClassInfo& info(void);                        \
     virtual bool execute(void);                                       \
     virtual bool isShell(void) { return info().is_shell; }            \
+    virtual bool isParallel(void) { return info().parallel; }         \
 };
 
 
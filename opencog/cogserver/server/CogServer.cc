@@ -12,11 +12,15 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <sys/prctl.h>
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
 
 #include <opencog/util/Logger.h>
 #include <opencog/util/misc.h>
 #include <opencog/util/platform.h>
 
+#include <opencog/network/GenericShell.h>
 #include <opencog/network/NetworkServer.h>
 
 #include <opencog/atoms/core/NumberNode.h>
@@ -32,13 +36,13 @@ using namespace opencog;
 
 // Helper to extract port value from a CogServerNode.
 // Accepts FloatValue or NumberNode.
-// Returns zero if key not found or value not understood.
-static int get_port(const Handle& hcsn, const char* key)
+// Returns `dflt` if key not found or value not understood.
+static int get_port(const Handle& hcsn, const char* key, int dflt = 0)
 {
     AtomSpace* asp = hcsn->getAtomSpace();
     Handle hkey = asp->add_atom(createNode(PREDICATE_NODE, key));
     ValuePtr vp = hcsn->getValue(hkey);
-    if (nullptr == vp) return 0;
+    if (nullptr == vp) return dflt;
 
     if (vp->is_type(FLOAT_VALUE))
         return FloatValueCast(vp)->value()[0];
@@ -46,7 +50,7 @@ static int get_port(const Handle& hcsn, const char* key)
     if (vp->is_type(NUMBER_NODE))
         return NumberNodeCast(vp)->get_value();
 
-    return 0;
+    return dflt;
 }
 
 CogServer::~CogServer()
@@ -54,6 +58,7 @@ CogServer::~CogServer()
     logger().debug("[CogServer] enter destructor");
     disableWebServer();
     disableNetworkServer();
+    _socket_manager.rem_stats_source(this);
     logger().debug("[CogServer] exit destructor");
 }
 
@@ -63,6 +68,67 @@ CogServer::CogServer(void) :
     _mcpServer(nullptr),
     _running(false)
 {
+    _socket_manager.add_stats_source(this,
+        [this]() { return display_request_stats(); });
+}
+
+// Stand-in for a command of a module that has not been loaded yet.
+// Loading the module replaces the stand-ins with the real commands.
+class ModuleStub : public AbstractFactory<Request>
+{
+private:
+    std::string _filename;
+    std::vector<std::string> _commands;
+    RequestClassInfo _info;
+
+public:
+    ModuleStub(const std::string& filename,
+               const std::vector<std::string>& commands,
+               const std::string& cmd) :
+        _filename(filename),
+        _commands(commands),
+        _info(cmd, "Loads " + filename + " on first use",
+              "This command is provided by " + filename + ", which\n"
+              "has not been loaded yet. Using the command loads it.\n")
+    {}
+
+    virtual Request* create(CogServer& cs) const
+    {
+        // One module at a time; a second user of the same command
+        // waits here, and then finds the real one.
+        static std::mutex mtx;
+        std::lock_guard<std::mutex> lock(mtx);
+
+        // If we are no longer the registered factory, then whoever
+        // held the lock before us has loaded the module already.
+        if (cs.find_factory(_info.id) != this)
+            return cs.RequestManager::createRequest(_info.id, cs);
+
+        if (not cs.loadModule(_filename, cs.getHandle()))
+            logger().warn("Failed to load module %s", _filename.c_str());
+
+        // Drop whatever stand-ins were not replaced, so that we
+        // cannot come back here.
+        for (const std::string& cmd : _commands)
+            cs.unregisterStub(cmd);
+
+        return cs.RequestManager::createRequest(_info.id, cs);
+    }
+
+    virtual const ClassInfo& info() const { return _info; }
+};
+
+bool CogServer::deferModule(const std::string& filename,
+                            const std::vector<std::string>& commands)
+{
+    if (getenv("COGSERVER_EAGER_MODULES")) return false;
+
+    for (const std::string& cmd : commands)
+    {
+        _module_stubs.emplace_back(new ModuleStub(filename, commands, cmd));
+        registerStub(cmd, _module_stubs.back().get());
+    }
+    return true;
 }
 
 /// Allow at most `max_open_socks` concurrent connections.
@@ -77,6 +143,64 @@ void CogServer::set_max_open_sockets(int max_open_socks)
     _socket_manager.set_max_open_sockets(max_open_socks);
 }
 
+/// Apply the connection-management settings found on the
+/// CogServerNode. Called before the network servers are started.
+void CogServer::configure(const Handle& hcsn)
+{
+    int maxsocks = get_port(hcsn, "*-max-open-sockets-*");
+    if (0 < maxsocks)
+        set_max_open_sockets(maxsocks);
+
+    // Optionally, let the limit float with the load, within bounds.
+    int amin = get_port(hcsn, "*-adaptive-sockets-min-*", 1);
+    int amax = get_port(hcsn, "*-adaptive-sockets-max-*");
+    if (0 < amax)
+        _socket_manager.set_adaptive_limit(std::max(amin, 1), amax);
+
+    // Connections beyond the max are parked in an admission queue,
+    // for at most the deadline (zero means forever). Connections
+    // beyond the queue depth get a "server busy" reply.
+    int depth = get_port(hcsn, "*-admission-queue-depth-*", 256);
+    int deadline = get_port(hcsn, "*-admission-deadline-ms-*", 0);
+    _socket_manager.set_admission_queue(std::max(depth, 0),
+                                        std::max(deadline, 0));
+
+    // Stop reading from a shell's socket when its eval queue holds
+    // this many commands, or this many bytes. Zero means unlimited.
+    int qcmds = get_port(hcsn, "*-eval-queue-max-cmds-*", 1000);
+    int qbytes = get_port(hcsn, "*-eval-queue-max-bytes-*", 16*1024*1024);
+    GenericShell::set_queue_limits(std::max(qcmds, 0), std::max(qbytes, 0));
+
+    // Give up on a (cog-barrier N "uuid") if not all N sockets have
+    // arrived in this many millisecs. Zero means wait forever.
+    int btmo = get_port(hcsn, "*-barrier-timeout-ms-*", 0);
+    _socket_manager.set_barrier_timeout(std::max(btmo, 0));
+
+    // Close connections that have been idle for this many seconds.
+    // Idle HTTP keep-alive connections are closed after a minute;
+    // the others are left open, unless configured.
+    _socket_manager.set_idle_timeout('T',
+        std::max(get_port(hcsn, "*-telnet-idle-timeout-*"), 0));
+    _socket_manager.set_idle_timeout('H',
+        std::max(get_port(hcsn, "*-http-idle-timeout-*", 60), 0));
+    _socket_manager.set_idle_timeout('W',
+        std::max(get_port(hcsn, "*-websocket-idle-timeout-*"), 0));
+    _socket_manager.set_idle_timeout('M',
+        std::max(get_port(hcsn, "*-mcp-idle-timeout-*"), 0));
+
+    // Run console commands on this many threads, so that a slow
+    // command does not hold up the other consoles.
+    int nworkers = get_port(hcsn, "*-request-workers-*", 1);
+    setRequestWorkers(std::max(nworkers, 1));
+
+    // TCP keepalive, so that peers that vanished without closing are
+    // noticed by the kernel. Zero leaves keepalive off.
+    _socket_manager.set_keepalive(
+        std::max(get_port(hcsn, "*-tcp-keepalive-idle-*"), 0),
+        std::max(get_port(hcsn, "*-tcp-keepalive-interval-*"), 0),
+        std::max(get_port(hcsn, "*-tcp-keepalive-count-*"), 0));
+}
+
 /// Open the given port number for network service.
 void CogServer::enableNetworkServer(const Handle& hcsn)
 {
@@ -86,7 +210,8 @@ void CogServer::enableNetworkServer(const Handle& hcsn)
 
     try
     {
-        _consoleServer = new NetworkServer(port, "Telnet Server", &_socket_manager);
+        _consoleServer = new NetworkServer(port, "Telnet Server",
+            &_socket_manager, get_port(hcsn, "*-listen-shards-*"));
     }
     catch (const std::system_error& ex)
     {
@@ -97,6 +222,10 @@ void CogServer::enableNetworkServer(const Handle& hcsn)
         std::rethrow_exception(std::current_exception());
     }
 
+    // Optionally, poll all connections from a few reactor threads,
+    // instead of running one thread per connection.
+    _consoleServer->use_reactor(get_port(hcsn, "*-telnet-reactor-threads-*"));
+
     auto make_console = [hcsn, this](SocketManager* mgr)->ServerSocket*
             { return new ServerConsole(hcsn, *this, mgr); };
     _consoleServer->run(make_console);
@@ -113,7 +242,8 @@ void CogServer::enableWebServer(const Handle& hcsn)
 
     try
     {
-        _webServer = new NetworkServer(port, "WebSocket Server", &_socket_manager);
+        _webServer = new NetworkServer(port, "WebSocket Server",
+            &_socket_manager, get_port(hcsn, "*-listen-shards-*"));
     }
     catch (const std::system_error& ex)
     {
@@ -124,6 +254,13 @@ void CogServer::enableWebServer(const Handle& hcsn)
         std::rethrow_exception(std::current_exception());
     }
 
+    // Optionally, poll all connections from a few reactor threads,
+    // instead of running one thread per connection.
+    _webServer->use_reactor(get_port(hcsn, "*-web-reactor-threads-*"));
+
+    // HTTP clients speak first; no need to wake up before they do.
+    _webServer->defer_accept(5);
+
     auto make_console = [hcsn, this](SocketManager* mgr)->ServerSocket* {
         ServerSocket* ss = new WebServer(hcsn, *this, mgr);
         ss->act_as_http_socket();
@@ -147,7 +284,8 @@ void CogServer::enableMCPServer(const Handle& hcsn)
 
     try
     {
-        _mcpServer = new NetworkServer(port, "Model Context Protocol Server", &_socket_manager);
+        _mcpServer = new NetworkServer(port, "Model Context Protocol Server",
+            &_socket_manager, get_port(hcsn, "*-listen-shards-*"));
     }
     catch (const std::system_error& ex)
     {
@@ -158,6 +296,13 @@ void CogServer::enableMCPServer(const Handle& hcsn)
         std::rethrow_exception(std::current_exception());
     }
 
+    // Optionally, poll all connections from a few reactor threads,
+    // instead of running one thread per connection.
+    _mcpServer->use_reactor(get_port(hcsn, "*-mcp-reactor-threads-*"));
+
+    // MCP clients speak first; no need to wake up before they do.
+    _mcpServer->defer_accept(5);
+
     auto make_console = [hcsn, this](SocketManager* mgr)->ServerSocket* {
         ServerSocket* ss = new MCPServer(hcsn, mgr);
         ss->act_as_mcp();
@@ -201,11 +346,11 @@ void CogServer::serverLoop()
     {
         try
         {
-            requestQueue.barrier();
+            requestQueue.wait();
             while (0 < getRequestQueueSize())
                 runLoopStep();
         }
-        catch (const concurrent_queue<Request*>::Canceled& ex)
+        catch (const RequestQueue::Canceled& ex)
         {
             break;
         }
@@ -251,6 +396,9 @@ void CogServer::serverLoop()
     _webServer = nullptr;
     _consoleServer = nullptr;
 
+    // Handler threads are gone; nothing more will be queued.
+    stopRequestWorkers();
+
     logger().info("Stopped CogServer");
     logger().flush();
 }
@@ -285,29 +433,80 @@ std::string CogServer::stats_legend(void)
 	return
        "The current date in UTC is printed, followed by:\n"
        "  up-since: the date when the server was started.\n"
-       "  last: the date when the most recent connection was opened.\n"
-       "  tot-cnct: grand total number of network connections opened.\n"
        "  cur-open-socks: number of currently open connections.\n"
        "  num-open-fds: number of open file descriptors.\n"
        "  stalls: times that open stalled due to hitting max-open-cnt.\n"
+       "  adaptive-limit: if enabled (*-adaptive-sockets-max-*), the\n"
+       "      current limit on open sockets, and its allowed range.\n"
+       "      eval-lat: smoothed evaluation latency; base: the lowest\n"
+       "      recent latency. runq: runnable threads, system-wide.\n"
+       "      history: the most recent limits, oldest first.\n"
+       "  admit-queue: connections waiting for a free slot, and the\n"
+       "      max allowed to wait (*-admission-queue-depth-*).\n"
+       "  deadline: longest a connection may wait, in millisecs\n"
+       "      (*-admission-deadline-ms-*); zero means forever.\n"
+       "  rejected: connections turned away with a \"server busy\" reply.\n"
+       "  wait-avg wait-max: time spent in the admission queue.\n"
+       "  out-dispatch: threads that forward shell output to sockets;\n"
+       "      busy ones are serving a shell that is evaluating.\n"
+       "      shells: number of shells served. ready: shells with\n"
+       "      output, waiting for a thread; max-ready: its high-water\n"
+       "      mark. polls: total number of times a shell was served.\n"
+       "  idle-reaper: for each socket kind (see the K column below),\n"
+       "      the idle timeout in secs (*-telnet-idle-timeout-* and so on;\n"
+       "      zero is never), and the number of sockets closed for idling.\n"
+       "      keepalive: TCP keepalive idle/interval/count, in secs.\n"
+       "  global-barrier: number of (cog-global-barrier) calls completed;\n"
+       "      waiting: calls now waiting for the other shells to drain.\n"
+       "      busy-shells: shells with queued or running work.\n"
+       "      wait-avg wait-max: time spent waiting in the barrier.\n"
+       "  cog-barrier: (cog-barrier N \"uuid\") calls in progress, and\n"
+       "      completed. timed-out: barriers abandoned because not all\n"
+       "      N sockets arrived in time (*-barrier-timeout-ms-*).\n"
+       "      skew-avg skew-max: time from first to last arrival.\n"
+       "      wait-avg wait-max: time each socket spent waiting.\n"
        "  tot-lines: total number of newlines received by all shells.\n"
        "  cpu user sys: number of CPU seconds used by server.\n"
        "  maxrss: resident set size, in KB. Taken from `getrusage`.\n"
+       "  requests: console commands. workers: threads that run them\n"
+       "      (*-request-workers-*); zero means the server loop does.\n"
+       "      running queued done: commands in each state.\n"
+       "      batch-avg batch-max: commands taken off the queue at once.\n"
+       "      wait-avg wait-max: time from being queued to being run.\n"
+       "  dispatch: the table used to look up commands. commands: the\n"
+       "      number registered; slots: size of the hash table. rebuilds:\n"
+       "      times it was rebuilt, as modules came and went.\n"
+       "For each network server (telnet, web, mcp):\n"
+       "  tot-cnct: grand total number of network connections opened.\n"
+       "  last: the date when the most recent connection was opened.\n"
+       "  pool-threads: connection handler threads; busy ones are\n"
+       "      serving a connection, idle ones wait to be reused.\n"
+       "      spawned reused: threads created, and threads recycled.\n"
+       "  reactor-threads: if a reactor is used instead of the pool;\n"
+       "      sockets: number of connections that it is polling.\n"
+       "  shard-cnct: connections accepted by each listener shard,\n"
+       "      if the port is bound more than once (*-listen-shards-*).\n"
        "\n"
        "The table shows a list of the currently open connections.\n"
        "The table header has the following form:\n"
-       "OPEN-DATE THREAD STATE NLINE LAST-ACTIVITY K U SHEL QZ E PENDG\n"
+       "OPEN-DATE THREAD STATE NLINE LAST-ACTIVITY K U SHEL QZ STL E PENDG\n"
        "The columns are:\n"
        "  OPEN-DATE -- when the connection was opened.\n"
-       "  THREAD -- the Linux thread-id, as printed by `ps -eLf`\n"
-       "  STATE -- several states possible; `iwait` means waiting for input.\n"
+       "  THREAD -- the Linux thread-id, as printed by `ps -eLf`;\n"
+       "            negative values are file descriptors of sockets\n"
+       "            that are polled by a reactor thread.\n"
+       "  STATE -- several states possible; `iwait` means waiting for input,\n"
+       "           `stall` means input is paused until the queue drains.\n"
        "  NLINE -- number of newlines received by the shell.\n"
        "  LAST-ACTIVITY -- the last time anything was received.\n"
        "  K -- socket kind. `T` for telnet, `W` for WebSocket,\n"
        "                    `H` for http, 'M' for MCP.\n"
        "  U -- use count. The number of active handlers for the socket.\n"
        "  SHEL -- the current shell processor for the socket.\n"
-       "  QZ -- size of the unprocessed (pending) request queue.\n"
+       "  QZ -- size of the unprocessed (pending) request queue. A `!`\n"
+       "        means the queue is full, and reading is paused.\n"
+       "  STL -- number of times reading was paused for a full queue\n"
+       "         (*-eval-queue-max-cmds-*, *-eval-queue-max-bytes-*).\n"
        "  E -- `T` if the shell evaluator is running, else `F`.\n"
        "  PENDG -- number of bytes of output not yet sent.\n"
        "\n";
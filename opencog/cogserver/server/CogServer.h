@@ -13,6 +13,7 @@
 #define _OPENCOG_COGSERVER_H
 
 #include <atomic>
+#include <memory>
 
 #include <opencog/atomspace/AtomSpace.h>
 
@@ -61,6 +62,10 @@ private:
     NetworkServer* _mcpServer;
     std::atomic<bool> _running;
 
+    // Placeholders for the commands of modules that are loaded
+    // on first use.
+    std::vector<std::unique_ptr<AbstractFactory<Request>>> _module_stubs;
+
 protected:
     // The following methods "could be" public (historically, they were)
     // but are now marked protected due to widespread abuse. Control is
@@ -71,6 +76,10 @@ protected:
     /// already running (i.e. already set by someone else).
     bool set_running(void) { return _running.exchange(true); }
 
+    /** Apply connection limits and similar settings, taken from
+     *  values on the CogServerNode. */
+    void configure(const Handle&);
+
     /** Starts the network console server; this provides a command
      *  line server socket on the specified port. */
     void enableNetworkServer(const Handle&);
@@ -94,6 +103,12 @@ protected:
     /** Runs a single server loop step. */
     void runLoopStep(void);
 
+    /** Register placeholders for the module's commands, so that it
+     *  gets loaded when one of them is first used. Not done if the
+     *  COGSERVER_EAGER_MODULES environment variable is set. */
+    virtual bool deferModule(const std::string&,
+                             const std::vector<std::string>&);
+
 public:
     CogServer(void);
     virtual ~CogServer(void);
@@ -32,6 +32,9 @@ protected:
 	virtual void OnConnection(void);
 	virtual void OnLine (const std::string&);
 
+	// MCP requests are evaluated in OnLine().
+	virtual bool handler_may_block(void) { return true; }
+
 public:
     MCPServer(const Handle&, SocketManager*);
     ~MCPServer();
@@ -14,6 +14,7 @@
 #include <cstdlib>
 #include <dlfcn.h>
 
+#include <chrono>
 #include <filesystem>
 
 #include <opencog/util/Logger.h>
@@ -104,6 +105,7 @@ static std::string get_filepath(const std::string& fullpath)
 bool ModuleManager::loadAbsPath(const std::string& path,
                                const Handle& hcsn)
 {
+    auto start = std::chrono::steady_clock::now();
     std::string fi = get_filename(path);
     if (modules.find(fi) !=  modules.end()) {
         logger().debug("Module \"%s\" is already loaded.", fi.c_str());
@@ -187,13 +189,20 @@ bool ModuleManager::loadAbsPath(const std::string& path,
     std::string i = module_id;
     std::string f = get_filename(path);
     std::string p = get_filepath(path);
-    ModuleData mdata = {module, i, f, p, load_func, unload_func, dynLibrary};
+    ModuleData mdata = {module, i, f, p, load_func, unload_func, dynLibrary, 0.0};
     modules[i] = mdata;
     modules[f] = mdata;
+    _deferred.erase(f);
 
     // after registration, call the module's init() method
     module->init();
 
+    double ms = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    modules[i].load_ms = ms;
+    modules[f].load_ms = ms;
+    logger().info("Loaded module \"%s\" in %.1f ms", f.c_str(), ms);
+
     return true;
 }
 
@@ -201,9 +210,10 @@ bool ModuleManager::loadAbsPath(const std::string& path,
 
 std::string ModuleManager::listModules()
 {
+    std::lock_guard<std::recursive_mutex> lock(_modules_mtx);
     std::string rv =
-        "   Module Name           Library            Module Directory Path\n"
-        "   -----------           -------            ---------------------\n";
+        "   Module Name           Library            Load ms  Module Directory Path\n"
+        "   -----------           -------            -------  ---------------------\n";
     for (const auto& modpr : modules)
     {
         // The list holds both lib.so's, and names.
@@ -220,9 +230,22 @@ std::string ModuleManager::listModules()
         if (38 < tlen)
             trunc = "..." + trunc.substr(tlen-35);
 
-        char buff[120];
-        snprintf(buff, 120, "%-21s %-18s %s\n", mdata.id.c_str(),
-                 mdata.filename.c_str(), trunc.c_str());
+        char buff[140];
+        snprintf(buff, sizeof(buff), "%-21s %-18s %8.1f  %s\n",
+                 mdata.id.c_str(), mdata.filename.c_str(),
+                 mdata.load_ms, trunc.c_str());
+        rv += buff;
+    }
+
+    for (const auto& defpr : _deferred)
+    {
+        std::string cmds;
+        for (const std::string& cmd : defpr.second)
+            cmds += " " + cmd;
+
+        char buff[140];
+        snprintf(buff, sizeof(buff), "%-21s %-18s %8s  (loaded on first use of:%s)\n",
+                 "-", defpr.first.c_str(), "-", cmds.c_str());
         rv += buff;
     }
 
@@ -233,6 +256,7 @@ std::string ModuleManager::listModules()
 
 bool ModuleManager::unloadModule(const std::string& moduleId)
 {
+    std::lock_guard<std::recursive_mutex> lock(_modules_mtx);
     ModuleData mdata = getModuleData(moduleId);
 
     // Unable to find the module!
@@ -271,11 +295,12 @@ bool ModuleManager::unloadModule(const std::string& moduleId)
 
 ModuleManager::ModuleData ModuleManager::getModuleData(const std::string& moduleId)
 {
+    std::lock_guard<std::recursive_mutex> lock(_modules_mtx);
     std::string f = get_filename(moduleId);
     ModuleMap::const_iterator it = modules.find(f);
     if (it == modules.end()) {
         logger().info("[ModuleManager] module \"%s\" was not found.", f.c_str());
-        static ModuleData nulldata = {NULL, "", "", "", NULL, NULL, NULL};
+        static ModuleData nulldata = {NULL, "", "", "", NULL, NULL, NULL, 0.0};
         return nulldata;
     }
     return it->second;
@@ -291,6 +316,9 @@ Module* ModuleManager::getModule(const std::string& moduleId)
 bool ModuleManager::loadModule(const std::string& path, const Handle& hcsn)
 {
     if (0 == path.size()) return false;
+
+    // Modules may be loaded on first use, from any thread.
+    std::lock_guard<std::recursive_mutex> lock(_modules_mtx);
     if ('/' == path[0])
         return loadAbsPath(path, hcsn);
 
@@ -304,25 +332,36 @@ bool ModuleManager::loadModule(const std::string& path, const Handle& hcsn)
             if (rc) break;
         }
     }
+
+    // A deferred module that cannot be found is not coming.
+    if (not rc) _deferred.erase(path);
     return rc;
 }
 
 void ModuleManager::loadModules(const Handle& hcsn)
 {
+    // The default modules, and the commands that they provide.
     // Search the build dirs first, then the install dirs.
-    std::string modlist =
-        "libbuiltinreqs.so, "
-        "libtop-shell.so, "
-        "libscheme-shell.so, "
-        "libsexpr-shell.so, "
-        "libjson-shell.so, "
-        "libmcp-shell.so, "
-        "libpy-shell.so";
-
-    std::vector<std::string> modules;
-    tokenize(modlist, std::back_inserter(modules), ", ");
+    static const std::vector<std::pair<std::string, std::vector<std::string>>>
+        modlist = {
+            {"libbuiltinreqs.so", {}},
+            {"libtop-shell.so", {"top"}},
+            {"libscheme-shell.so", {"scm"}},
+            {"libsexpr-shell.so", {"sexpr"}},
+            {"libjson-shell.so", {"json"}},
+            {"libmcp-shell.so", {"mcp"}},
+            {"libpy-shell.so", {"py", "py-eval"}},
+        };
+
     bool load_failure = false;
-    for (const std::string& module : modules) {
+    for (const auto& mod : modlist) {
+        const std::string& module = mod.first;
+        if (not mod.second.empty() and deferModule(module, mod.second))
+        {
+            std::lock_guard<std::recursive_mutex> lock(_modules_mtx);
+            _deferred[module] = mod.second;
+            continue;
+        }
         bool rc = loadModule(module, hcsn);
         if (not rc)
         {
@@ -13,6 +13,7 @@
 #define _OPENCOG_MODULE_MANAGER_H
 
 #include <map>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -51,11 +52,17 @@ protected:
         Module::LoadFunction*   loadFunction;
         Module::UnloadFunction* unloadFunction;
         void*                   handle;
+        double                  load_ms;
     } ModuleData;
 
     // Container used to store references to the modules.
     typedef std::map<const std::string, ModuleData> ModuleMap;
     ModuleMap modules;
+    std::recursive_mutex _modules_mtx;
+
+    // Default modules that have not been loaded yet, and the
+    // commands that will load them.
+    std::map<std::string, std::vector<std::string>> _deferred;
 
     /** Retrieves the module's meta-data (id, filename, load/unload
      * function pointers, etc). Takes the module's id */
@@ -66,13 +73,23 @@ protected:
 
     /** filepath must be an absolute path, i.e. start with a slash. */
     bool loadAbsPath(const std::string& filepath, const Handle&);
+
+    /**
+     * Called by loadModules() for each default module that provides
+     * the given commands. Return true to skip loading it now; it is
+     * then up to the caller to load it when one of the commands is
+     * first used. By default, all modules are loaded right away.
+     */
+    virtual bool deferModule(const std::string& filename,
+                             const std::vector<std::string>& commands)
+    { return false; }
 public:
 
     /** ModuleManager's constructor. */
     ModuleManager(void);
 
     /** ModuleManager's destructor. Unloads all modules. */
-    ~ModuleManager();
+    virtual ~ModuleManager();
 
     /** Loads a dynamic library/module. Takes the filename of the
      *  library (.so or .dylib or .dll). On Linux/Unix, the filename may
@@ -86,7 +103,9 @@ public:
      *  more details. */
     bool unloadModule(const std::string& id);
 
-    /** Lists the modules that are currently loaded. */
+    /** Lists the modules that are currently loaded, with the time it
+     *  took to load each, and the modules that will be loaded on
+     *  first use. */
     std::string listModules(void);
 
     /** Retrieves the module's instance. Takes the module's id */
@@ -7,17 +7,228 @@
  * Implementation of static page server
  */
 
-#include <fstream>
-#include <sstream>
+#include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <sstream>
 
 #include <opencog/util/Logger.h>
+#include <opencog/network/Compress.h>
+#include <opencog/network/ServerSocket.h>
 #include <opencog/cogserver/server/PageServer.h>
 
 using namespace opencog;
 
 const std::string PageServer::base_path = PROJECT_INSTALL_PREFIX "/share/cogserver";
 
+// Files larger than this are not held in memory; they are sent
+// straight from the page cache with sendfile().
+static const size_t sendfile_min = 256 * 1024;
+
+// Limit on the total size of the files held in memory. Once it is
+// reached, further files are sent with sendfile().
+static const size_t max_cached_bytes = 32 * 1024 * 1024;
+
+// Limits on the number of cached files, and on how many of those
+// may hold an open file descriptor. Files beyond these are loaded
+// afresh for each request.
+static const size_t max_cached_files = 1024;
+static const size_t max_cached_fds = 64;
+
+/// A static file, as cached in memory.
+struct PageServer::Asset
+{
+    std::string filepath;       // Empty for preloaded assets.
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+
+    time_t last_modified;
+    std::string etag;
+    std::string header;         // Complete 200 OK header.
+    std::string not_modified;   // Complete 304 response.
+    std::string body;           // Empty if sent with sendfile().
+    int fd;                     // Open, if sent with sendfile().
+
+    // The gzip'ed variant, for text that is held in memory.
+    // Empty if there is none.
+    std::string gz_etag;
+    std::string gz_header;
+    std::string gz_not_modified;
+    std::string gz_body;
+
+    Asset() : dev(0), ino(0), size(0), mtime{0, 0},
+              last_modified(0), fd(-1) {}
+    ~Asset() { if (0 <= fd) close(fd); }
+
+    bool matches(const struct stat& st) const
+    {
+        return st.st_dev == dev and st.st_ino == ino and
+            st.st_size == size and
+            st.st_mtim.tv_sec == mtime.tv_sec and
+            st.st_mtim.tv_nsec == mtime.tv_nsec;
+    }
+};
+
+// Files are keyed by file path; preloaded assets by URL path.
+// Both are charged to cached_bytes.
+static std::mutex cache_mtx;
+static std::map<std::string, std::shared_ptr<const PageServer::Asset>> cache;
+static std::map<std::string, std::shared_ptr<const PageServer::Asset>> preloaded;
+static size_t cached_bytes = 0;
+static size_t cached_fds = 0;
+
+// Remove a cache entry, and refund what it was charged.
+// Call with cache_mtx held.
+static void uncache(decltype(cache)::iterator it)
+{
+    const PageServer::Asset& a = *it->second;
+    cached_bytes -= a.body.size() + a.gz_body.size();
+    if (0 <= a.fd) cached_fds--;
+    cache.erase(it);
+}
+
+// Decide how a freshly loaded asset is kept, charge it, and place it
+// into the cache if there is room. The decision and the charge are
+// made together, so that concurrent loads cannot overshoot the
+// limits. Call with cache_mtx held.
+static std::shared_ptr<const PageServer::Asset>
+admit(const std::string& key, std::shared_ptr<PageServer::Asset> a)
+{
+    size_t bytes = a->body.size() + a->gz_body.size();
+    bool in_memory = a->body.size() == (size_t) a->size;
+    if (in_memory and max_cached_bytes < cached_bytes + bytes) {
+        // Over budget; send it from the file instead.
+        a->body.clear();
+        a->body.shrink_to_fit();
+        a->gz_body.clear();
+        a->gz_body.shrink_to_fit();
+        in_memory = false;
+        bytes = 0;
+    }
+    if (in_memory and 0 <= a->fd) {
+        close(a->fd);
+        a->fd = -1;
+    }
+
+    if (max_cached_files <= cache.size()) return a;
+    if (0 <= a->fd and max_cached_fds <= cached_fds) return a;
+
+    cached_bytes += bytes;
+    if (0 <= a->fd) cached_fds++;
+    cache.emplace(key, a);
+    return a;
+}
+
+// The URL path, with empty and "." segments dropped, so that
+// "/a//./b/" and "/a/b" name the same file. (".." is refused by
+// isSafePath().)
+static std::string clean_path(const std::string& path)
+{
+    std::string clean;
+    size_t pos = 0;
+    while (pos < path.size()) {
+        size_t end = path.find('/', pos);
+        if (end == std::string::npos) end = path.size();
+        if (pos < end && path.compare(pos, end - pos, ".") != 0) {
+            clean += '/';
+            clean.append(path, pos, end - pos);
+        }
+        pos = end + 1;
+    }
+    return clean;
+}
+
+// HTTP date, as in "Sun, 06 Nov 1994 08:49:37 GMT".
+static std::string http_date(time_t t)
+{
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    char buf[40];
+    strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return buf;
+}
+
+// Text that is at least this long is also kept gzip'ed.
+static const size_t gzip_min = 1024;
+
+// Fill in the precomputed parts of the response.
+static void make_headers(PageServer::Asset& a, const std::string& mime_type)
+{
+    std::string lastmod = http_date(a.last_modified);
+
+    std::ostringstream hdr;
+    hdr << "HTTP/1.1 200 OK\r\n";
+    hdr << "Server: CogServer\r\n";
+    hdr << "Content-Type: " << mime_type << "\r\n";
+    hdr << "Content-Length: " << a.size << "\r\n";
+    hdr << "ETag: " << a.etag << "\r\n";
+    hdr << "Last-Modified: " << lastmod << "\r\n";
+    hdr << "Cache-Control: no-cache\r\n";
+    hdr << "\r\n";
+    a.header = hdr.str();
+
+    std::ostringstream nm;
+    nm << "HTTP/1.1 304 Not Modified\r\n";
+    nm << "Server: CogServer\r\n";
+    nm << "ETag: " << a.etag << "\r\n";
+    nm << "Last-Modified: " << lastmod << "\r\n";
+    nm << "Cache-Control: no-cache\r\n";
+    nm << "\r\n";
+    a.not_modified = nm.str();
+
+#ifdef HAVE_ZLIB
+    // Text compresses well; compress it once, here, as hard as zlib
+    // can, rather than on every request.
+    bool text = 0 == mime_type.compare(0, 5, "text/") or
+        mime_type == "application/javascript" or
+        mime_type == "application/json";
+    if (not text or a.body.size() < gzip_min) return;
+
+    std::string gz = Deflater::gzip(a.body, Z_BEST_COMPRESSION);
+    if (a.body.size() <= gz.size()) return;
+    a.gz_body = std::move(gz);
+
+    // A different representation needs a different strong ETag.
+    a.gz_etag = a.etag;
+    a.gz_etag.insert(a.gz_etag.size() - 1, "-gz");
+
+    std::ostringstream ghdr;
+    ghdr << "HTTP/1.1 200 OK\r\n";
+    ghdr << "Server: CogServer\r\n";
+    ghdr << "Content-Type: " << mime_type << "\r\n";
+    ghdr << "Content-Encoding: gzip\r\n";
+    ghdr << "Vary: Accept-Encoding\r\n";
+    ghdr << "Content-Length: " << a.gz_body.size() << "\r\n";
+    ghdr << "ETag: " << a.gz_etag << "\r\n";
+    ghdr << "Last-Modified: " << lastmod << "\r\n";
+    ghdr << "Cache-Control: no-cache\r\n";
+    ghdr << "\r\n";
+    a.gz_header = ghdr.str();
+
+    std::ostringstream gnm;
+    gnm << "HTTP/1.1 304 Not Modified\r\n";
+    gnm << "Server: CogServer\r\n";
+    gnm << "Vary: Accept-Encoding\r\n";
+    gnm << "ETag: " << a.gz_etag << "\r\n";
+    gnm << "Last-Modified: " << lastmod << "\r\n";
+    gnm << "Cache-Control: no-cache\r\n";
+    gnm << "\r\n";
+    a.gz_not_modified = gnm.str();
+
+    // Caches must know that the plain reply also depends on it.
+    std::string vary = "Vary: Accept-Encoding\r\n";
+    a.header.insert(a.header.size() - 2, vary);
+    a.not_modified.insert(a.not_modified.size() - 2, vary);
+#endif // HAVE_ZLIB
+}
+
 std::string PageServer::getMimeType(const std::string& filename)
 {
     size_t dot_pos = filename.rfind('.');
@@ -40,18 +251,6 @@ std::string PageServer::getMimeType(const std::string& filename)
     return "application/octet-stream";
 }
 
-std::string PageServer::readFile(const std::string& filepath)
-{
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file) {
-        return "";
-    }
-
-    std::ostringstream contents;
-    contents << file.rdbuf();
-    return contents.str();
-}
-
 bool PageServer::isSafePath(const std::string& path)
 {
     // Check for directory traversal attempts
@@ -68,7 +267,61 @@ bool PageServer::isSafePath(const std::string& path)
     return true;
 }
 
-std::string PageServer::serve(const std::string& url)
+std::shared_ptr<PageServer::Asset> PageServer::load(const std::string& filepath)
+{
+    int fd = open(filepath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+
+    // Use the stat of the open file, so that the asset describes
+    // exactly what was read, even if the file is being replaced.
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        close(fd);
+        return nullptr;
+    }
+
+    auto a = std::make_shared<Asset>();
+    a->filepath = filepath;
+    a->dev = st.st_dev;
+    a->ino = st.st_ino;
+    a->size = st.st_size;
+    a->mtime = st.st_mtim;
+    a->last_modified = st.st_mtim.tv_sec;
+    a->fd = fd;
+
+    // A strong validator: any change to the file changes one of
+    // the inode, the size or the modification time.
+    char etag[80];
+    snprintf(etag, sizeof(etag), "\"%lx-%lx-%lx.%lx\"",
+             (unsigned long) st.st_ino, (unsigned long) st.st_size,
+             (unsigned long) st.st_mtim.tv_sec,
+             (unsigned long) st.st_mtim.tv_nsec);
+    a->etag = etag;
+
+    // Small files are read into memory. The file is closed once
+    // the asset is admitted to the cache.
+    size_t size = st.st_size;
+    if (size < sendfile_min) {
+        a->body.resize(size);
+        size_t got = 0;
+        while (got < size) {
+            ssize_t n = pread(fd, &a->body[got], size - got, got);
+            if (n < 0 && EINTR == errno) continue;
+            if (n <= 0) break;
+            got += n;
+        }
+        if (got != size) {
+            return nullptr;
+        }
+    }
+
+    make_headers(*a, getMimeType(filepath));
+    return a;
+}
+
+PageServer::AssetPtr PageServer::lookup(const std::string& url)
 {
     // Strip query string if present
     std::string path = url;
@@ -80,66 +333,201 @@ std::string PageServer::serve(const std::string& url)
     // Security check
     if (!isSafePath(path)) {
         logger().warn("[PageServer] Unsafe path requested: %s", path.c_str());
-        return notFound(url);
+        return nullptr;
     }
 
+    path = clean_path(path);
+
     // Build the full file path
     std::string filepath = base_path;
+    filepath += path.empty() ? "/index.html" : path;
 
-    // Handle root request
-    if (path == "/" || path.empty()) {
-        filepath += "/index.html";
-    } else if (path[0] == '/') {
-        filepath += path;
-    } else {
-        filepath += "/" + path;
+    AssetPtr cached;
+    {
+        std::lock_guard<std::mutex> lock(cache_mtx);
+        auto pit = preloaded.find(path);
+        if (pit != preloaded.end()) {
+            return pit->second;
+        }
+        auto it = cache.find(filepath);
+        if (it != cache.end()) {
+            cached = it->second;
+        }
+    }
+
+    // A cache hit costs one stat(), to see if the file changed.
+    if (cached) {
+        struct stat st;
+        if (stat(cached->filepath.c_str(), &st) == 0 && cached->matches(st)) {
+            return cached;
+        }
     }
 
     // Check if file exists
     struct stat file_stat;
-    if (stat(filepath.c_str(), &file_stat) != 0) {
+    std::shared_ptr<Asset> asset;
+    std::string loadpath = filepath;
+    if (stat(loadpath.c_str(), &file_stat) != 0) {
         // File doesn't exist
-        logger().debug("[PageServer] File not found: %s", filepath.c_str());
-        return notFound(url);
+        logger().debug("[PageServer] File not found: %s", loadpath.c_str());
+    } else if (S_ISREG(file_stat.st_mode)) {
+        asset = load(loadpath);
+        if (!asset) {
+            logger().warn("[PageServer] Could not read file: %s", loadpath.c_str());
+        }
+    } else if (S_ISDIR(file_stat.st_mode)) {
+        // If it's a directory, try index.html
+        loadpath += "/index.html";
+        if (stat(loadpath.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
+            logger().debug("[PageServer] Directory without index.html: %s", url.c_str());
+        } else if (!(asset = load(loadpath))) {
+            logger().warn("[PageServer] Could not read file: %s", loadpath.c_str());
+        }
+    } else {
+        logger().debug("[PageServer] Not a regular file: %s", loadpath.c_str());
     }
 
-    // Make sure it's a regular file, not a directory
-    if (!S_ISREG(file_stat.st_mode)) {
-        // If it's a directory, try index.html
-        if (S_ISDIR(file_stat.st_mode)) {
-            filepath += "/index.html";
-            if (stat(filepath.c_str(), &file_stat) != 0 || !S_ISREG(file_stat.st_mode)) {
-                logger().debug("[PageServer] Directory without index.html: %s", url.c_str());
-                return notFound(url);
-            }
-        } else {
-            logger().debug("[PageServer] Not a regular file: %s", filepath.c_str());
-            return notFound(url);
+    // Update the cache, unless some other thread got there first.
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    auto it = cache.find(filepath);
+    if (it != cache.end() && it->second != cached) {
+        return it->second;
+    }
+    if (it != cache.end()) {
+        uncache(it);
+    }
+    if (!asset) {
+        return nullptr;
+    }
+    return admit(filepath, asset);
+}
+
+bool PageServer::notModified(const Asset& asset, const std::string& etag,
+                             const std::string& if_none_match,
+                             const std::string& if_modified_since)
+{
+    // If-None-Match takes precedence; it holds a list of ETags,
+    // or a star. The comparison is the weak one (RFC 9110).
+    if (!if_none_match.empty()) {
+        std::istringstream tags(if_none_match);
+        std::string tag;
+        while (std::getline(tags, tag, ',')) {
+            size_t b = tag.find_first_not_of(" \t");
+            size_t e = tag.find_last_not_of(" \t");
+            if (b == std::string::npos) continue;
+            tag = tag.substr(b, e - b + 1);
+            if (tag == "*") return true;
+            if (0 == tag.compare(0, 2, "W/")) tag = tag.substr(2);
+            if (tag == etag) return true;
         }
+        return false;
+    }
+
+    if (!if_modified_since.empty()) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char* end = strptime(if_modified_since.c_str(),
+                                   "%a, %d %b %Y %H:%M:%S GMT", &tm);
+        if (nullptr == end) return false;
+        return asset.last_modified <= timegm(&tm);
     }
 
-    // Read the file
-    std::string content = readFile(filepath);
-    if (content.empty()) {
-        logger().warn("[PageServer] Could not read file: %s", filepath.c_str());
+    return false;
+}
+
+std::string PageServer::serve(const std::string& url)
+{
+    AssetPtr asset = lookup(url);
+    if (!asset) {
         return notFound(url);
     }
 
-    // Build HTTP response
-    std::string mime_type = getMimeType(filepath);
+    std::string response = asset->header;
+    if (asset->fd < 0) {
+        response += asset->body;
+        return response;
+    }
 
-    std::ostringstream response;
-    response << "HTTP/1.1 200 OK\r\n";
-    response << "Server: CogServer\r\n";
-    response << "Content-Type: " << mime_type << "\r\n";
-    response << "Content-Length: " << content.length() << "\r\n";
-    response << "\r\n";
-    response << content;
+    // Not held in memory; read it.
+    size_t hlen = response.size();
+    response.resize(hlen + asset->size);
+    size_t got = 0;
+    while (got < (size_t) asset->size) {
+        ssize_t n = pread(asset->fd, &response[hlen + got],
+                          asset->size - got, got);
+        if (n < 0 && EINTR == errno) continue;
+        if (n <= 0) break;
+        got += n;
+    }
+    if (got != (size_t) asset->size) {
+        logger().warn("[PageServer] Could not read file: %s",
+                      asset->filepath.c_str());
+        return notFound(url);
+    }
+    return response;
+}
+
+void PageServer::serve(ServerSocket& sock, const std::string& url,
+                       const std::string& if_none_match,
+                       const std::string& if_modified_since,
+                       bool accept_gzip)
+{
+    AssetPtr asset = lookup(url);
+    if (!asset) {
+        sock.Send(notFound(url));
+        return;
+    }
 
-    logger().debug("[PageServer] Served %s (%s, %zu bytes)",
-                  url.c_str(), mime_type.c_str(), content.length());
+    bool gz = accept_gzip && !asset->gz_body.empty();
+    const std::string& etag = gz ? asset->gz_etag : asset->etag;
+    if (notModified(*asset, etag, if_none_match, if_modified_since)) {
+        sock.Send(gz ? asset->gz_not_modified : asset->not_modified);
+        logger().debug("[PageServer] Not modified: %s", url.c_str());
+        return;
+    }
 
-    return response.str();
+    if (gz) {
+        sock.Send({asio::buffer(asset->gz_header), asio::buffer(asset->gz_body)});
+    } else if (asset->fd < 0) {
+        sock.Send({asio::buffer(asset->header), asio::buffer(asset->body)});
+    } else {
+        sock.SendFile(asset->header, asset->fd, 0, asset->size);
+    }
+
+    logger().debug("[PageServer] Served %s (%zu bytes)",
+                  url.c_str(), (size_t) asset->size);
+}
+
+void PageServer::preload(const std::string& url,
+                         const std::string& mime_type,
+                         const std::string& content)
+{
+    auto a = std::make_shared<Asset>();
+    a->size = content.size();
+    a->last_modified = time(nullptr);
+    a->body = content;
+
+    // With no file to go by, the ETag is a hash of the contents.
+    uint64_t h = 14695981039346656037ULL;
+    for (unsigned char c : content) {
+        h = (h ^ c) * 1099511628211ULL;
+    }
+    char etag[40];
+    snprintf(etag, sizeof(etag), "\"%016llx\"", (unsigned long long) h);
+    a->etag = etag;
+
+    make_headers(*a, mime_type);
+
+    // Preloaded assets are always kept; there are only a few.
+    std::string path = clean_path(url);
+    std::lock_guard<std::mutex> lock(cache_mtx);
+    auto it = preloaded.find(path);
+    if (it != preloaded.end()) {
+        cached_bytes -= it->second->body.size() + it->second->gz_body.size();
+        preloaded.erase(it);
+    }
+    cached_bytes += a->body.size() + a->gz_body.size();
+    preloaded.emplace(path, a);
 }
 
 std::string PageServer::notFound(const std::string& url)
@@ -10,31 +10,62 @@
 #ifndef _OPENCOG_PAGE_SERVER_H
 #define _OPENCOG_PAGE_SERVER_H
 
+#include <memory>
 #include <string>
 
 namespace opencog
 {
 
+class ServerSocket;
+
 /**
  * PageServer - Serves static content from /usr/local/share/cogserver
  *
  * This class handles serving static HTML, CSS, JS, and favicon.ico files
  * from the cogserver's shared data directory.
+ *
+ * Files are cached in memory, keyed by file path, together with their
+ * response headers and a strong ETag; a cached file is revalidated
+ * with a single stat() on each request. Large files are not kept in
+ * memory; they are sent with sendfile() instead. The cache is bounded
+ * in bytes, in files, and in open file descriptors. Conditional requests
+ * (If-None-Match, If-Modified-Since) get a 304 when the file is
+ * unchanged.
  */
 class PageServer
 {
+public:
+    /// A cached file; defined in PageServer.cc.
+    struct Asset;
+    typedef std::shared_ptr<const Asset> AssetPtr;
+
 private:
     static const std::string base_path;
 
     /**
-     * Get the MIME type for a file based on its extension
+     * Return the cached asset for the URL, (re-)loading it if it
+     * is missing or stale. Returns null if there is no such file.
      */
-    static std::string getMimeType(const std::string& filename);
+    static AssetPtr lookup(const std::string& url);
+
+    /**
+     * Load a file into a new asset. Small files are read into
+     * memory, but the file is left open, in case the asset does
+     * not fit into the cache.
+     */
+    static std::shared_ptr<Asset> load(const std::string& filepath);
+
+    /**
+     * Does the client already have this version of the asset?
+     */
+    static bool notModified(const Asset&, const std::string& etag,
+                            const std::string& if_none_match,
+                            const std::string& if_modified_since);
 
     /**
-     * Read a file from disk
+     * Get the MIME type for a file based on its extension
      */
-    static std::string readFile(const std::string& filepath);
+    static std::string getMimeType(const std::string& filename);
 
     /**
      * Check if a file path is safe (no directory traversal)
@@ -50,6 +81,25 @@ public:
      */
     static std::string serve(const std::string& url);
 
+    /**
+     * Serve a static file on the socket, or a 404 response. A 304
+     * Not Modified is sent instead, if the conditional request
+     * headers show that the client already has the file. Text files
+     * are sent gzip'ed to clients that accept that.
+     */
+    static void serve(ServerSocket&, const std::string& url,
+                      const std::string& if_none_match,
+                      const std::string& if_modified_since,
+                      bool accept_gzip = false);
+
+    /**
+     * Place an asset that has no backing file into the cache, so
+     * that it is served from memory, e.g. a built-in favicon.
+     */
+    static void preload(const std::string& url,
+                        const std::string& mime_type,
+                        const std::string& content);
+
     /**
      * Generate a 404 Not Found response
      */
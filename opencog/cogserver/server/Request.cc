@@ -10,6 +10,8 @@
  * explore writing guile (scheme) or python modules instead.
  */
 
+#include <mutex>
+
 #include <opencog/util/exceptions.h>
 #include <opencog/util/Logger.h>
 #include <opencog/util/oc_assert.h>
@@ -22,7 +24,7 @@
 using namespace opencog;
 
 Request::Request(CogServer& cs) :
-    _console(nullptr), _cogserver(cs)
+    _console(nullptr), _next(nullptr), _argc(0), _cogserver(cs)
 {
 }
 
@@ -75,6 +77,96 @@ void Request::setParameters(const std::list<std::string>& params)
     _parameters.assign(params.begin(), params.end());
 }
 
+void Request::setParameters(std::list<std::string>&& params)
+{
+    _parameters = std::move(params);
+}
+
+void Request::setLine(const std::string& line)
+{
+    _line = line;
+    _argc = 0;
+    _argv_more.clear();
+
+    bool first = true;
+    tokenize(_line, [&](std::string_view word) {
+        if (first) { first = false; return true; }
+        if (_argc < max_inline_args)
+            _argv[_argc] = word;
+        else
+        {
+            if (_argv_more.empty())
+                _argv_more.assign(_argv, _argv + max_inline_args);
+            _argv_more.push_back(word);
+        }
+        _argc++;
+        return true;
+    });
+}
+
+// ==================================================================
+// Freed Requests are kept on free lists, one for each size, and are
+// handed out again to the next Request of that size. In practice,
+// that is one free list per Request class.
+
+namespace {
+struct FreeList
+{
+    std::mutex mtx;
+    void* head = nullptr;
+    size_t count = 0;
+};
+
+static constexpr size_t pool_grain = 16;
+static constexpr size_t pool_bins = 32;       // Up to 512 bytes
+static constexpr size_t pool_max_free = 64;   // Per free list
+
+// Never destroyed, because Requests may be deleted during exit.
+FreeList* free_lists(void)
+{
+    static FreeList* lists = new FreeList[pool_bins];
+    return lists;
+}
+}
+
+void* Request::operator new(size_t sz)
+{
+    size_t bin = (sz + pool_grain - 1) / pool_grain;
+    if (pool_bins <= bin) return ::operator new(sz);
+
+    FreeList& fl = free_lists()[bin];
+    {
+        std::lock_guard<std::mutex> lock(fl.mtx);
+        if (fl.head)
+        {
+            void* p = fl.head;
+            fl.head = *static_cast<void**>(p);
+            fl.count--;
+            return p;
+        }
+    }
+    return ::operator new(bin * pool_grain);
+}
+
+void Request::operator delete(void* p, size_t sz)
+{
+    size_t bin = (sz + pool_grain - 1) / pool_grain;
+    if (pool_bins <= bin) { ::operator delete(p); return; }
+
+    FreeList& fl = free_lists()[bin];
+    {
+        std::lock_guard<std::mutex> lock(fl.mtx);
+        if (fl.count < pool_max_free)
+        {
+            *static_cast<void**>(p) = fl.head;
+            fl.head = p;
+            fl.count++;
+            return;
+        }
+    }
+    ::operator delete(p);
+}
+
 void Request::addParameter(const std::string& param)
 {
     _parameters.push_back(param);
@@ -15,8 +15,12 @@
 #ifndef _OPENCOG_REQUEST_H
 #define _OPENCOG_REQUEST_H
 
+#include <chrono>
 #include <list>
 #include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
 
 #include <opencog/cogserver/server/Factory.h>
 
@@ -29,6 +33,27 @@ namespace opencog
 class CogServer;
 class ConsoleSocket;
 
+/**
+ * The arguments of a command, as views into the command line that
+ * is held by the Request. Valid for as long as the Request is.
+ */
+class ArgSpan
+{
+private:
+    const std::string_view* _begin;
+    size_t _size;
+
+public:
+    ArgSpan(const std::string_view* b, size_t n) : _begin(b), _size(n) {}
+
+    const std::string_view* begin(void) const { return _begin; }
+    const std::string_view* end(void) const { return _begin + _size; }
+    size_t size(void) const { return _size; }
+    bool empty(void) const { return 0 == _size; }
+    const std::string_view& front(void) const { return _begin[0]; }
+    const std::string_view& operator[](size_t i) const { return _begin[i]; }
+};
+
 /**
  * The DECLARE_CMD_REQUEST macro provides a simple, easy-to-use interface
  * to the creation of new modules, while also shielding the module writer
@@ -119,9 +144,46 @@ class ConsoleSocket;
  * commands with the command processing subsystem, implement the "do"
  * routine, and go. A module may declare as many commands as desired.
  * Be sure to register and unregister each command.
+ *
+ * Commands declared this way are run one at a time, with no other
+ * command running alongside. If the "do" routine is thread-safe,
+ * declare it with DECLARE_PARALLEL_CMD_REQUEST instead (same
+ * arguments); it may then run at the same time as other parallel
+ * commands, when the server has more than one request worker.
+ *
+ * Commands that are issued at a high rate by scripts can avoid
+ * copying their arguments into a list of strings. Declare them with
+ * DECLARE_FAST_CMD_REQUEST, which takes one more argument, a boolean
+ * that is the same as choosing DECLARE_PARALLEL_CMD_REQUEST. The
+ * "do" routine then gets the arguments as string_views:
+ *
+ * @code
+ * std::string MyModule::do_stirfry(Request *r, ArgSpan args) {
+ *     for (const std::string_view& ingredient : args) ...
+ * }
+ * @endcode
  */
 #define DECLARE_CMD_REQUEST(mod_type,cmd_str,do_cmd,                  \
                             cmd_sum,cmd_desc,shell_cmd,hidden)        \
+    DECLARE_CMD_REQUEST_CLASS(mod_type,cmd_str,do_cmd,                \
+                            cmd_sum,cmd_desc,shell_cmd,hidden,false,  \
+                            std::list<std::string>)
+
+#define DECLARE_PARALLEL_CMD_REQUEST(mod_type,cmd_str,do_cmd,         \
+                            cmd_sum,cmd_desc,shell_cmd,hidden)        \
+    DECLARE_CMD_REQUEST_CLASS(mod_type,cmd_str,do_cmd,                \
+                            cmd_sum,cmd_desc,shell_cmd,hidden,true,   \
+                            std::list<std::string>)
+
+#define DECLARE_FAST_CMD_REQUEST(mod_type,cmd_str,do_cmd,             \
+                            cmd_sum,cmd_desc,shell_cmd,hidden,par)    \
+    DECLARE_CMD_REQUEST_CLASS(mod_type,cmd_str,do_cmd,                \
+                            cmd_sum,cmd_desc,shell_cmd,hidden,par,    \
+                            ArgSpan)
+
+#define DECLARE_CMD_REQUEST_CLASS(mod_type,cmd_str,do_cmd,            \
+                            cmd_sum,cmd_desc,shell_cmd,hidden,par,    \
+                            arg_type)                                 \
                                                                       \
    class do_cmd##Request : public Request {                           \
       public:                                                         \
@@ -130,7 +192,8 @@ class ConsoleSocket;
                                                  cmd_sum,             \
                                                  cmd_desc,            \
                                                  shell_cmd,           \
-                                                 hidden);             \
+                                                 hidden,              \
+                                                 par);                \
               return _cci;                                            \
           }                                                           \
           do_cmd##Request(CogServer& cs) : Request(cs) {};            \
@@ -142,20 +205,27 @@ class ConsoleSocket;
                   static_cast<mod_type *>(_cogserver.getModule(       \
                                           #mod_type));                \
                                                                       \
-              std::string rs = mod->do_cmd(this, _parameters);        \
+              std::string rs = mod->do_cmd(this,                      \
+                                           cmd_args<arg_type>());     \
               send(rs);                                               \
               return true;                                            \
           }                                                           \
           virtual bool isShell(void) {                                \
               return info().is_shell;                                 \
           }                                                           \
+          virtual bool isParallel(void) {                             \
+              return info().parallel;                                 \
+          }                                                           \
+          virtual bool isFast(void) {                                 \
+              return std::is_same<arg_type, ArgSpan>::value;          \
+          }                                                           \
     };                                                                \
                                                                       \
     /* Declare the factory to manage this request */                  \
     Factory<do_cmd##Request, Request> do_cmd##Factory;                \
                                                                       \
     /* Declare the method that performs the actual action */          \
-    std::string do_cmd(Request *, std::list<std::string>);            \
+    std::string do_cmd(Request *, arg_type);                          \
                                                                       \
     /* Declare routines to register and unregister the factories */   \
     void do_cmd##_register(void) {                                    \
@@ -231,13 +301,32 @@ class ConsoleSocket;
  */
 class Request
 {
+    friend class RequestQueue;
+
 private:
     ConsoleSocket*         _console;
 
+    // Link and time-stamp, set when the Request is queued.
+    Request*               _next;
+    std::chrono::steady_clock::time_point _queued_at;
+
+    // The command line, and views of its arguments, for requests
+    // that take an ArgSpan. Most commands have only a few arguments;
+    // the vector is used only for those that have more.
+    static constexpr size_t max_inline_args = 16;
+    std::string            _line;
+    std::string_view       _argv[max_inline_args];
+    std::vector<std::string_view> _argv_more;
+    size_t                 _argc;
+
 protected:
     CogServer&             _cogserver;
     std::list<std::string> _parameters;
 
+    /** The arguments, as passed to the module's "do" routine. The
+     *  list form hands over the parameters; it can be used once. */
+    template<typename T> T cmd_args(void);
+
 public:
     /** Request's constructor */
     Request(CogServer&);
@@ -253,6 +342,14 @@ public:
     /** Return true, if running the Request will create and enter a shell. */
     virtual bool isShell(void) = 0;
 
+    /** Return true, if the Request may run at the same time as other
+     *  parallel Requests. By default, Requests run one at a time. */
+    virtual bool isParallel(void) { return false; }
+
+    /** Return true, if the Request takes its arguments with
+     *  setLine(), instead of setParameters(). */
+    virtual bool isFast(void) { return false; }
+
     /** Send the command output back to the client. */
     void send(const std::string& msg) const;
 
@@ -260,13 +357,82 @@ public:
     void set_console(ConsoleSocket*);
     ConsoleSocket *get_console(void) const { return _console; }
 
+    /** When the Request was put on the request queue. */
+    std::chrono::steady_clock::time_point queued_at(void) const
+    { return _queued_at; }
+
     /** sets the command's parameter list. */
     virtual void setParameters(const std::list<std::string>&);
+    virtual void setParameters(std::list<std::string>&&);
+
+    /** Keep a copy of the command line, and split it into arguments,
+     *  skipping the first word (the command name). */
+    void setLine(const std::string&);
+
+    /** The arguments set with setLine(). */
+    ArgSpan args(void) const
+    {
+        if (_argv_more.empty()) return ArgSpan(_argv, _argc);
+        return ArgSpan(_argv_more.data(), _argc);
+    }
+
+    /** Split a command line at blanks. Quotes are stripped. Calls
+     *  `emit` with each word, in turn, until it returns false. */
+    template<typename F>
+    static void tokenize(std::string_view line, F&& emit);
+
+    /** Requests are small, and are created and destroyed for every
+     *  command; recycle their memory. */
+    static void* operator new(size_t);
+    static void operator delete(void*, size_t);
 
     /** adds a parameter to the commands parameter list. */
     virtual void addParameter(const std::string&);
 };
 
+template<>
+inline std::list<std::string> Request::cmd_args(void)
+{
+    return std::move(_parameters);
+}
+
+template<>
+inline ArgSpan Request::cmd_args(void)
+{
+    return args();
+}
+
+/// XXX escaped quotes are not handled correctly. FIXME.
+/// This passes over quotes embedded in the middle strings.
+/// And that OK, because what the heck did you want to happen?
+template<typename F>
+void Request::tokenize(std::string_view line, F&& emit)
+{
+    size_t pos = 0;
+    size_t len = line.size();
+    while (pos < len) {
+        // Gather up everything until the next quote.
+        if ('\"' == line[pos]) {
+            size_t start = ++pos; // skip over opening quote
+            while (pos < len and '\"' != line[pos]) pos++;
+            if (not emit(line.substr(start, pos - start))) return;
+            pos++; // skip over closing quote
+            continue;
+        }
+
+        // Gather up everything until the next blank space.
+        if (' ' != line[pos]) {
+            size_t start = pos;
+            while (pos < len and ' ' != line[pos]) pos++;
+            if (not emit(line.substr(start, pos - start))) return;
+            continue;
+        }
+
+        // Skip over blank spaces.
+        while (pos < len and ' ' == line[pos]) pos++;
+    }
+}
+
 /** @}*/
 } // namespace 
 
@@ -27,6 +27,9 @@ namespace opencog
  *     description: a short description of what the request does
  *     help:        an extended description of the request, listing multiple
  *                  usage patterns and parameters
+ *     parallel:    the request may run at the same time as other parallel
+ *                  requests. Requests that are not parallel-safe are run
+ *                  one at a time, with nothing else running alongside.
  */
 struct RequestClassInfo : public ClassInfo
 {
@@ -35,17 +38,22 @@ struct RequestClassInfo : public ClassInfo
     bool is_shell;
     /** Whether default shell should be hidden from help */
     bool hidden;
+    /** Whether the request may run concurrently with others */
+    bool parallel;
 
-    RequestClassInfo() : is_shell(false), hidden(false) {};
+    RequestClassInfo() : is_shell(false), hidden(false), parallel(false) {};
     RequestClassInfo(const char* i, const char *d, const char* h,
-            bool s = false, bool hide = false)
-        : ClassInfo(i), description(d), help(h), is_shell(s), hidden(hide) {};
+            bool s = false, bool hide = false, bool par = false)
+        : ClassInfo(i), description(d), help(h), is_shell(s), hidden(hide),
+          parallel(par) {};
     RequestClassInfo(const std::string& i, 
                      const std::string& d,
                      const std::string& h, 
                      bool s = false,
-                     bool hide = false)
-        : ClassInfo(i), description(d), help(h), is_shell(s), hidden(hide) {};
+                     bool hide = false,
+                     bool par = false)
+        : ClassInfo(i), description(d), help(h), is_shell(s), hidden(hide),
+          parallel(par) {};
 };
 
 
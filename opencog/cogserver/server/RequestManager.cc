@@ -14,6 +14,7 @@
 
 #include <time.h>
 #include <unistd.h>
+#include <sys/prctl.h>
 #include <sys/time.h>
 
 #include <opencog/util/Logger.h>
@@ -26,11 +27,26 @@
 
 using namespace opencog;
 
+// Most requests that are taken off of the queue at once.
+static constexpr size_t max_batch = 64;
+
 RequestManager::~RequestManager()
 {
+    stopRequestWorkers();
 }
 
-RequestManager::RequestManager(void)
+RequestManager::RequestManager(void) :
+    _dispatch_rebuilds(0),
+    _nexecuted(0),
+    _nbatches(0),
+    _nbatched(0),
+    _max_batch(0),
+    _wait_total_us(0),
+    _wait_max_us(0),
+    _npending(0),
+    _nrunning(0),
+    _exclusive(false),
+    _exec_stop(false)
 {
 }
 
@@ -38,12 +54,202 @@ RequestManager::RequestManager(void)
 
 void RequestManager::processRequests(void)
 {
+    if (not _workers.empty())
+    {
+        // Hand them over to the workers.
+        std::lock_guard<std::mutex> lock(_exec_mtx);
+        dispatch();
+        return;
+    }
+
     std::lock_guard<std::mutex> lock(processRequestsMutex);
-    while (0 < getRequestQueueSize()) {
-        Request* request = popRequest();
+    Request* batch[max_batch];
+    size_t n;
+    while (0 < (n = requestQueue.pop(batch, max_batch))) {
+        record_batch(n);
+        for (size_t i = 0; i < n; i++) {
+            record_wait(batch[i]);
+            batch[i]->execute();
+            delete batch[i];
+        }
+    }
+}
+
+/// Wait until all of the requests from this console have run.
+void RequestManager::processRequests(ConsoleSocket* con)
+{
+    if (_workers.empty())
+    {
+        processRequests();
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(_exec_mtx);
+    dispatch();
+    _done_cv.wait(lock, [&] { return 0 == _lanes.count(con); });
+}
+
+// Move the queued requests into the lane for their console.
+// Caller must hold the lock. All pops from the request queue
+// happen under this lock, so a request is always either in the
+// queue or in a lane.
+void RequestManager::dispatch(void)
+{
+    Request* batch[max_batch];
+    size_t n;
+    while (0 < (n = requestQueue.pop(batch, max_batch)))
+    {
+        record_batch(n);
+        for (size_t i = 0; i < n; i++)
+        {
+            ConsoleSocket* con = batch[i]->get_console();
+            Lane& lane = _lanes[con];
+            if (lane.pending.empty() and not lane.running)
+                _ready.push_back(con);
+            lane.pending.push_back(batch[i]);
+        }
+        _npending += n;
+    }
+    _work_cv.notify_all();
+}
+
+// True if the request at the head of the ready queue can start now.
+// An exclusive request waits for all others to finish; requests
+// behind it wait as well, so that it cannot be starved. Caller must
+// hold the lock.
+bool RequestManager::runnable(void)
+{
+    if (_ready.empty() or _exclusive) return false;
+    if (0 == _nrunning) return true;
+    return _lanes.at(_ready.front()).pending.front()->isParallel();
+}
+
+void RequestManager::worker(void)
+{
+    prctl(PR_SET_NAME, "cogserv:request", 0, 0, 0);
+
+    std::unique_lock<std::mutex> lock(_exec_mtx);
+    while (true)
+    {
+        _work_cv.wait(lock, [this] {
+            return runnable() or (_exec_stop and 0 == _npending); });
+        if (not runnable()) break;
+
+        ConsoleSocket* con = _ready.front();
+        _ready.pop_front();
+        Lane& lane = _lanes.at(con);
+        Request* request = lane.pending.front();
+        lane.pending.pop_front();
+        lane.running = true;
+
+        bool exclusive = not request->isParallel();
+        if (exclusive) _exclusive = true;
+        _npending--;
+        _nrunning++;
+        lock.unlock();
+
+        record_wait(request);
         request->execute();
         delete request;
+
+        lock.lock();
+        _nrunning--;
+        if (exclusive) _exclusive = false;
+        lane.running = false;
+        if (lane.pending.empty())
+            _lanes.erase(con);
+        else
+            _ready.push_back(con);
+
+        _work_cv.notify_all();
+        _done_cv.notify_all();
+    }
+}
+
+void RequestManager::setRequestWorkers(size_t nworkers)
+{
+    if (nworkers <= 1 or not _workers.empty()) return;
+
+    logger().info("[RequestManager] Starting %zu request workers", nworkers);
+    std::lock_guard<std::mutex> lock(_exec_mtx);
+    _exec_stop = false;
+    for (size_t i = 0; i < nworkers; i++)
+        _workers.emplace_back(&RequestManager::worker, this);
+}
+
+void RequestManager::stopRequestWorkers(void)
+{
+    if (_workers.empty()) return;
+    {
+        std::lock_guard<std::mutex> lock(_exec_mtx);
+        dispatch();
+        _exec_stop = true;
+        _work_cv.notify_all();
+    }
+    for (std::thread& thr : _workers)
+        thr.join();
+    _workers.clear();
+}
+
+void RequestManager::record_batch(size_t n)
+{
+    _nbatches.fetch_add(1, std::memory_order_relaxed);
+    _nbatched.fetch_add(n, std::memory_order_relaxed);
+    size_t prev = _max_batch.load(std::memory_order_relaxed);
+    while (prev < n and not _max_batch.compare_exchange_weak(prev, n,
+                                std::memory_order_relaxed)) {}
+}
+
+// Time from being queued to being run.
+void RequestManager::record_wait(const Request* request)
+{
+    using namespace std::chrono;
+    uint64_t us = duration_cast<microseconds>(
+        steady_clock::now() - request->queued_at()).count();
+
+    _nexecuted.fetch_add(1, std::memory_order_relaxed);
+    _wait_total_us.fetch_add(us, std::memory_order_relaxed);
+    uint64_t prev = _wait_max_us.load(std::memory_order_relaxed);
+    while (prev < us and not _wait_max_us.compare_exchange_weak(prev, us,
+                                std::memory_order_relaxed)) {}
+}
+
+std::string RequestManager::display_request_stats(void)
+{
+    size_t nexec = _nexecuted.load(std::memory_order_relaxed);
+    size_t nbat = _nbatches.load(std::memory_order_relaxed);
+    double wait = 0 < nexec ?
+        1.0e-3 * _wait_total_us.load(std::memory_order_relaxed) / nexec : 0.0;
+    double batch = 0 < nbat ?
+        ((double) _nbatched.load(std::memory_order_relaxed)) / nbat : 0.0;
+
+    size_t nrun, npend;
+    {
+        std::lock_guard<std::mutex> lock(_exec_mtx);
+        nrun = _nrunning;
+        npend = _npending;
+    }
+
+    char buff[200];
+    snprintf(buff, sizeof(buff),
+        "requests: workers: %zu  running: %zu  queued: %zu  done: %zu  batch-avg: %.1f  batch-max: %zu  wait-avg: %.2f ms  wait-max: %.2f ms\n",
+        _workers.size(), nrun, requestQueue.size() + npend, nexec,
+        batch, _max_batch.load(std::memory_order_relaxed),
+        wait, 1.0e-3 * _wait_max_us.load(std::memory_order_relaxed));
+    std::string rc = buff;
+
+    size_t ncmds, nrebuilds;
+    {
+        std::lock_guard<std::mutex> lock(_factories_mtx);
+        ncmds = _factories.size();
+        nrebuilds = _dispatch_rebuilds;
     }
+    std::shared_ptr<const DispatchTable> tab = std::atomic_load(&_dispatch);
+    snprintf(buff, sizeof(buff),
+        "dispatch: commands: %zu  slots: %zu  rebuilds: %zu\n",
+        ncmds, tab ? tab->slots.size() : 0, nrebuilds);
+    rc += buff;
+    return rc;
 }
 
 // =============================================================
@@ -52,40 +258,124 @@ void RequestManager::processRequests(void)
 bool RequestManager::registerRequest(const std::string& name,
                                      AbstractFactory<Request> const* factory)
 {
-    return _factories.insert({name, factory}).second;
+    std::lock_guard<std::mutex> lock(_factories_mtx);
+    if (1 == _stubs.erase(name))
+        _factories[name] = factory;
+    else if (not _factories.insert({name, factory}).second)
+        return false;
+    rebuild_dispatch();
+    return true;
 }
 
 bool RequestManager::unregisterRequest(const std::string& name)
 {
-    return _factories.erase(name) == 1;
+    std::lock_guard<std::mutex> lock(_factories_mtx);
+    if (_factories.erase(name) != 1) return false;
+    _stubs.erase(name);
+    rebuild_dispatch();
+    return true;
+}
+
+bool RequestManager::registerStub(const std::string& name,
+                                  AbstractFactory<Request> const* factory)
+{
+    std::lock_guard<std::mutex> lock(_factories_mtx);
+    if (not _factories.insert({name, factory}).second) return false;
+    _stubs.insert(name);
+    rebuild_dispatch();
+    return true;
+}
+
+bool RequestManager::unregisterStub(const std::string& name)
+{
+    std::lock_guard<std::mutex> lock(_factories_mtx);
+    if (0 == _stubs.erase(name)) return false;
+    _factories.erase(name);
+    rebuild_dispatch();
+    return true;
+}
+
+// Build a new dispatch table from _factories, and publish it.
+// Caller must hold _factories_mtx.
+void RequestManager::rebuild_dispatch(void)
+{
+    // Start at twice the number of commands, and double the size
+    // until no two commands share a slot. Give up on that after a
+    // while; linear probing takes care of any collisions left.
+    size_t size = 16;
+    while (size < 2 * _factories.size()) size *= 2;
+    size_t max_size = std::max<size_t>(4096, size);
+
+    for (; size < max_size; size *= 2)
+    {
+        std::vector<bool> used(size, false);
+        bool collided = false;
+        for (const auto& fact : _factories)
+        {
+            size_t i = request_hash(fact.first) & (size - 1);
+            if (used[i]) { collided = true; break; }
+            used[i] = true;
+        }
+        if (not collided) break;
+    }
+
+    DispatchTable* tab = new DispatchTable();
+    tab->mask = size - 1;
+    tab->slots.resize(size, DispatchSlot{0, "", nullptr});
+    for (const auto& fact : _factories)
+    {
+        uint32_t h = request_hash(fact.first);
+        size_t i = h & tab->mask;
+        while (tab->slots[i].factory) i = (i + 1) & tab->mask;
+        tab->slots[i] = DispatchSlot{h, fact.first, fact.second};
+    }
+
+    std::atomic_store(&_dispatch, std::shared_ptr<const DispatchTable>(tab));
+    _dispatch_rebuilds++;
+}
+
+AbstractFactory<Request> const*
+RequestManager::find_factory(std::string_view name) const
+{
+    std::shared_ptr<const DispatchTable> tab = std::atomic_load(&_dispatch);
+    if (nullptr == tab) return nullptr;
+
+    uint32_t h = request_hash(name);
+    for (size_t i = h & tab->mask; ; i = (i + 1) & tab->mask)
+    {
+        const DispatchSlot& slot = tab->slots[i];
+        if (nullptr == slot.factory) return nullptr;
+        if (h == slot.hash and name == slot.name) return slot.factory;
+    }
 }
 
 Request* RequestManager::createRequest(const std::string& name,
                                        CogServer& cs)
 {
-    const auto it = _factories.find(name);
-    if (it == _factories.end()) {
+    AbstractFactory<Request> const* factory = find_factory(name);
+    if (nullptr == factory) {
         // Probably a user typo at the server prompt.
         logger().debug("Cannot create unknown request \"%s\"", name.c_str());
         return nullptr;
     }
-    return it->second->create(cs);
+    return factory->create(cs);
 }
 
 const RequestClassInfo& RequestManager::requestInfo(const std::string& name) const
 {
     static RequestClassInfo emptyClassInfo;
-    const auto it = _factories.find(name);
-    if (it == _factories.end()) {
+    AbstractFactory<Request> const* factory = find_factory(name);
+    if (nullptr == factory) {
         // Probably a user typo at the server prompt.
         logger().debug("No info about unknown request \"%s\"", name.c_str());
         return emptyClassInfo;
     }
-    return static_cast<const RequestClassInfo&>(it->second->info());
+    return static_cast<const RequestClassInfo&>(factory->info());
 }
 
 std::list<const char*> RequestManager::requestIds() const
 {
+    std::lock_guard<std::mutex> lock(_factories_mtx);
     std::list<const char*> l;
     for (const auto& fact : _factories)
         l.push_back(fact.first.c_str());
@@ -15,13 +15,21 @@
 #ifndef _OPENCOG_REQUEST_MANAGER_H
 #define _OPENCOG_REQUEST_MANAGER_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
 #include <mutex>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
-#include <opencog/util/concurrent_queue.h>
 #include <opencog/cogserver/server/Factory.h>
 #include <opencog/cogserver/server/Request.h>
 #include <opencog/cogserver/server/RequestClassInfo.h>
+#include <opencog/cogserver/server/RequestQueue.h>
 
 namespace opencog
 {
@@ -47,18 +55,93 @@ namespace opencog
  * or until they kill it.  The GenericShell suppoprts out-of-band
  * ctrl-C, so the user can always ctrl-C to kill an out-of-control
  * Scheme or Python job.
+ *
+ * By default, requests are run one after another, by the server loop.
+ * When more than one request worker is configured, they are handed
+ * to a pool of worker threads instead, so that one slow request does
+ * not hold up the commands typed on other consoles. Requests coming
+ * from the same console are still run in the order received, one at
+ * a time. Requests that are not marked as parallel-safe (see
+ * RequestClassInfo::parallel) run alone: they wait for the running
+ * requests to finish, and nothing else starts until they are done.
  */
 class RequestManager
 {
+public:
+    /** FNV-1a hash of a command name. */
+    static constexpr uint32_t request_hash(std::string_view name)
+    {
+        uint32_t h = 2166136261u;
+        for (char c : name)
+            h = (h ^ (unsigned char) c) * 16777619u;
+        return h;
+    }
+
 protected:
     std::map<const std::string, AbstractFactory<Request> const*>
         _factories;
 
+    // Hashed copy of _factories, used to look up commands. It is
+    // rebuilt, and published anew, whenever a command is registered
+    // or unregistered; readers take a snapshot, without locking. The
+    // table is made large enough that, if possible, no two commands
+    // land in the same slot; lookups then take a single probe.
+    struct DispatchSlot
+    {
+        uint32_t hash;
+        std::string name;
+        AbstractFactory<Request> const* factory;
+    };
+    struct DispatchTable
+    {
+        std::vector<DispatchSlot> slots;
+        uint32_t mask;
+    };
+    mutable std::mutex _factories_mtx;
+    std::set<std::string> _stubs;
+    std::shared_ptr<const DispatchTable> _dispatch;
+    size_t _dispatch_rebuilds;
+    void rebuild_dispatch(void);
+
     // Container used to store references to requests
     std::map<const std::string, Request*> requests;
 
     std::mutex processRequestsMutex;
-    concurrent_queue<Request*> requestQueue;
+    RequestQueue requestQueue;
+
+    // Stats: time spent on the queue, and the size of the batches
+    // taken off of it.
+    std::atomic<size_t> _nexecuted;
+    std::atomic<size_t> _nbatches;
+    std::atomic<size_t> _nbatched;
+    std::atomic<size_t> _max_batch;
+    std::atomic<uint64_t> _wait_total_us;
+    std::atomic<uint64_t> _wait_max_us;
+    void record_batch(size_t);
+    void record_wait(const Request*);
+
+    // Request workers. Requests are kept in order, per console;
+    // a console is on the ready queue when it has requests, and
+    // none of them is running.
+    struct Lane
+    {
+        std::deque<Request*> pending;
+        bool running;
+    };
+    std::mutex _exec_mtx;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+    std::unordered_map<ConsoleSocket*, Lane> _lanes;
+    std::deque<ConsoleSocket*> _ready;
+    std::vector<std::thread> _workers;
+    size_t _npending;
+    size_t _nrunning;
+    bool _exclusive;
+    bool _exec_stop;
+
+    void worker(void);
+    bool runnable(void);
+    void dispatch(void);
 
 public:
 
@@ -78,6 +161,18 @@ public:
     /** Unregister a request class/type. Takes the class' id. */
     bool unregisterRequest(const std::string& id);
 
+    /** Register a placeholder for a request class. A later call to
+     *  registerRequest() for the same id replaces it. */
+    bool registerStub(const std::string& id,
+                      AbstractFactory<Request> const* factory);
+
+    /** Unregister a placeholder, if it has not been replaced. */
+    bool unregisterStub(const std::string& id);
+
+    /** The factory currently registered for 'id' (which may be a
+     *  placeholder), or null if there is none. */
+    AbstractFactory<Request> const* find_factory(std::string_view id) const;
+
     /** Returns a list with the ids of all the registered request classes. */
     std::list<const char*> requestIds(void) const;
 
@@ -95,14 +190,39 @@ public:
      */
     void pushRequest(Request* request) { requestQueue.push(request); }
 
-    /** Removes and returns the first request from the requests queue. */
-    Request* popRequest(void) { return requestQueue.value_pop(); }
+    /**
+     * Removes and returns the first request from the requests queue,
+     * or null, if the queue is empty. Only one thread at a time may
+     * pop requests.
+     */
+    Request* popRequest(void)
+    {
+        Request* request = nullptr;
+        requestQueue.pop(&request, 1);
+        return request;
+    }
 
     /** Returns the requests queue size. */
     int getRequestQueueSize(void) { return requestQueue.size(); }
 
     /** Force drain of all outstanding requests */
     void processRequests(void);
+
+    /** Force drain of the outstanding requests from one console */
+    void processRequests(ConsoleSocket*);
+
+    /**
+     * Run requests on `nworkers` threads. With zero or one workers,
+     * requests are run by whoever calls processRequests(), one at a
+     * time. Must be called before the server loop is started.
+     */
+    void setRequestWorkers(size_t nworkers);
+
+    /** Run the remaining requests, and then join the workers. */
+    void stopRequestWorkers(void);
+
+    /** One line of stats, newline-terminated. */
+    std::string display_request_stats(void);
 }; // class
 
 /** @}*/
@@ -0,0 +1,137 @@
+/*
+ * opencog/cogserver/server/RequestQueue.h
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifndef _OPENCOG_REQUEST_QUEUE_H
+#define _OPENCOG_REQUEST_QUEUE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include <opencog/cogserver/server/Request.h>
+
+namespace opencog
+{
+/** \addtogroup grp_server
+ *  @{
+ */
+
+/**
+ * Multi-producer, single-consumer queue of Requests.
+ *
+ * The queue is intrusive: it is threaded through the Requests
+ * themselves, and so pushing a Request does not allocate. Producers
+ * (the socket handler threads) push with a single compare-and-swap;
+ * the lock is taken only to wake up a consumer that is waiting on an
+ * empty queue. The consumer takes everything that has been pushed
+ * with a single exchange, and then hands it out in batches, oldest
+ * first.
+ *
+ * There may be several threads that consume, but they must not do
+ * so at the same time; the RequestManager serializes them.
+ */
+class RequestQueue
+{
+private:
+    std::atomic<Request*> _head;     // Newest first.
+    Request* _batch;                 // Oldest first; consumer only.
+    std::atomic<size_t> _size;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _canceled;
+
+public:
+    class Canceled {};
+
+    RequestQueue(void) :
+        _head(nullptr), _batch(nullptr), _size(0), _canceled(false) {}
+
+    /// Append a Request, and time-stamp it.
+    void push(Request* req)
+    {
+        req->_queued_at = std::chrono::steady_clock::now();
+
+        // Count it before it becomes visible, so that the size
+        // never goes negative.
+        _size.fetch_add(1, std::memory_order_relaxed);
+        Request* old = _head.load(std::memory_order_relaxed);
+        do {
+            req->_next = old;
+        } while (not _head.compare_exchange_weak(old, req,
+                    std::memory_order_release, std::memory_order_relaxed));
+
+        // Wake the consumer, if the queue was empty.
+        if (nullptr == old)
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _cv.notify_all();
+        }
+    }
+
+    /// Remove up to `max` Requests, oldest first. Does not block;
+    /// returns the number removed.
+    size_t pop(Request** out, size_t max)
+    {
+        size_t n = 0;
+        while (n < max)
+        {
+            if (nullptr == _batch)
+            {
+                Request* lifo = _head.exchange(nullptr,
+                                               std::memory_order_acquire);
+                if (nullptr == lifo) break;
+
+                // Reverse, to put them in arrival order.
+                while (lifo)
+                {
+                    Request* next = lifo->_next;
+                    lifo->_next = _batch;
+                    _batch = lifo;
+                    lifo = next;
+                }
+            }
+            out[n++] = _batch;
+            _batch = _batch->_next;
+        }
+        _size.fetch_sub(n, std::memory_order_relaxed);
+        return n;
+    }
+
+    /// Block until the queue is not empty. Throws Canceled if the
+    /// queue is (or gets) canceled.
+    void wait(void)
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _cv.wait(lock, [this] { return _canceled or 0 < size(); });
+        if (_canceled) throw Canceled();
+    }
+
+    void cancel(void)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _canceled = true;
+        _cv.notify_all();
+    }
+
+    void cancel_reset(void)
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _canceled = false;
+    }
+
+    /// Approximate; exact when no one is pushing.
+    size_t size(void) const
+    {
+        return _size.load(std::memory_order_relaxed);
+    }
+};
+
+/** @}*/
+}  // namespace
+
+#endif // _OPENCOG_REQUEST_QUEUE_H
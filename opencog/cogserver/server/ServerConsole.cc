@@ -276,48 +276,13 @@ void ServerConsole::sendPrompt()
 
 
 /// Parse command line. Quotes are stripped.
-/// XXX escaped quotes are not handled correctly. FIXME.
-/// This passes over quotes embedded in the middle strings.
-/// And that OK, because what the heck did you want to happen?
 static std::list<std::string> simple_tokenize(const std::string& line)
 {
     std::list<std::string> params;
-    size_t pos = 0;
-    size_t len = line.size();
-    while (pos<len) {
-        // Gather up everything until the next quote.
-        if ('\"' == line[pos]) {
-            std::string buff;
-            pos++; // skip over opening quote
-            while ('\"' != line[pos] and pos < len) {
-               buff.push_back(line[pos]);
-               pos++;
-            }
-            pos++; // skip over closing quote
-            params.push_back(buff);
-            if (len <= pos) break;
-            continue;
-        }
-
-        // Gather up everything until the next blank space.
-        if (' ' != line[pos]) {
-            std::string buff;
-            while (' ' != line[pos] and pos < len) {
-               buff.push_back(line[pos]);
-               pos++;
-            }
-            params.push_back(buff);
-            if (len <= pos) break;
-            continue;
-        }
-
-        // Skip over blank spaces.
-        if (' ' == line[pos]) {
-            while (' ' == line[pos] and pos < len) pos++;
-            if (len <= pos) break;
-            continue;
-        }
-    }
+    Request::tokenize(line, [&](std::string_view word) {
+        params.emplace_back(word);
+        return true;
+    });
     return params;
 }
 
@@ -381,20 +346,22 @@ void ServerConsole::OnLine(const std::string& line)
 
     logger().debug("[ServerConsole] OnLine [%s]", line.c_str());
 
-    // Parse command line. Quotes are stripped.
-    // tokenize(line, std::back_inserter(params), " \t\v\f");
-    std::list<std::string> params = simple_tokenize(line);
-
-    logger().debug("params.size(): %d", params.size());
-    if (params.empty()) {
+    // Only the command name is needed to find the request; the
+    // arguments are split up later, in whatever form it wants.
+    std::string cmdName;
+    bool blank = true;
+    Request::tokenize(line, [&](std::string_view word) {
+        cmdName = word;
+        blank = false;
+        return false;
+    });
+
+    if (blank) {
         // return on empty/blank line
         sendPrompt();
         return;
     }
 
-    std::string cmdName = params.front();
-    params.pop_front();
-
     Request* request = cs.createRequest(cmdName);
 
     // Command not found.
@@ -416,7 +383,14 @@ void ServerConsole::OnLine(const std::string& line)
     }
 
     request->set_console(this);
-    request->setParameters(params);
+    if (request->isFast())
+        request->setLine(line);
+    else
+    {
+        std::list<std::string> params = simple_tokenize(line);
+        params.pop_front();
+        request->setParameters(std::move(params));
+    }
     bool is_shell = request->isShell();
 
     // Add the command to the processing queue.
@@ -434,7 +408,7 @@ void ServerConsole::OnLine(const std::string& line)
         // shell mode before handling any additional input from the
         // socket (since all subsequent input will be for the new shell,
         // not for the cogserver command processor).
-        cs.processRequests();
+        cs.processRequests(this);
     }
 }
 
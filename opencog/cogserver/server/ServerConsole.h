@@ -62,6 +62,13 @@ protected:
      */
     void OnLine(const std::string&);
 
+    /**
+     * Commands are run right away, and entering a shell waits for
+     * the request queue to drain; once in a shell, lines are only
+     * queued up for it.
+     */
+    bool handler_may_block(void) { return not hasShell(); }
+
 public:
     /**
      * Ctor. Defines the socket's mime-type as 'text/plain' and then
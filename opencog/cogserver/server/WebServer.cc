@@ -7,7 +7,11 @@
 
 #ifdef HAVE_OPENSSL
 
+#include <chrono>
+#include <condition_variable>
 #include <cstring>
+#include <exception>
+#include <mutex>
 #include <string>
 #include <openssl/sha.h>
 
@@ -15,6 +19,8 @@
 #include <opencog/util/Logger.h>
 #include <opencog/util/misc.h>
 
+#include <opencog/network/Compress.h>
+#include <opencog/network/HandlerPool.h>
 #include <opencog/cogserver/server/CogServer.h>
 #include <opencog/cogserver/server/PageServer.h>
 #include <opencog/cogserver/server/WebServer.h>
@@ -22,10 +28,22 @@
 
 using namespace opencog;
 
+// Replies larger than this, or that take longer than this to produce,
+// are streamed, instead of being collected and sent in one piece.
+// Thus, this is about as much as is held in memory for a reply.
+static constexpr size_t stream_cap = 64 * 1024;
+static constexpr std::chrono::milliseconds stream_after(50);
+
+// Replies shorter than this are not compressed; it would hardly
+// save anything.
+static constexpr size_t gzip_min = 1024;
+
 WebServer::WebServer(const Handle&, CogServer& cs, SocketManager* mgr) :
 	ConsoleSocket(mgr),
 	_cserver(cs),
-	_request(nullptr)
+	_request(nullptr),
+	_served(false),
+	_gzip_stream(nullptr)
 {
 }
 
@@ -35,20 +53,34 @@ WebServer::~WebServer()
 	// traffic coming from systemd which pings it every 5 seconds.
 	// Or maybe its the gnome dbus or soething like that.
 	logger().debug("Closed WebSocket Shell");
+#ifdef HAVE_ZLIB
+	delete _gzip_stream;
+#endif
 }
 
 // ==================================================================
 
-// Called before any data is sent/received.
+// Called for each HTTP request header received. On a persistent
+// connection, this is called again for each following request.
 void WebServer::OnConnection(void)
 {
 	if (0 == _url.compare("/favicon.ico"))
 	{
-		Send(favicon());
-		throw SilentException();
+		// Decode it once; after that, it is served from the cache.
+		static std::once_flag icon_once;
+		std::call_once(icon_once, [] {
+			PageServer::preload("/favicon.ico",
+				"image/vnd.microsoft.icon", favicon());
+		});
+		PageServer::serve(*this, _url, _if_none_match, _if_modified_since,
+		                  _accept_gzip);
+		finish_response();
+		return;
 	}
 	if (0 == _url.compare("/stats"))
 	{
+		// The stats page has no Content-Length; closing the
+		// connection marks the end of it.
 		Send(html_stats());
 		throw SilentException();
 	}
@@ -58,18 +90,21 @@ void WebServer::OnConnection(void)
 	if (0 == _url.compare("/.well-known/oauth-protected-resource"))
 	{
 		Send(oauth_protected_resource());
-		throw SilentException();
+		finish_response();
+		return;
 	}
 	if (0 == _url.compare("/.well-known/oauth-authorization-server"))
 	{
 		Send(oauth_authorization_server());
-		throw SilentException();
+		finish_response();
+		return;
 	}
 	// Handle the /register endpoint that Claude is looking for
 	if (0 == _url.compare("/register"))
 	{
 		Send(oauth_register_not_required());
-		throw SilentException();
+		finish_response();
+		return;
 	}
 #endif
 
@@ -77,6 +112,19 @@ void WebServer::OnConnection(void)
 	// whatever, and, stripping away the leading slash, it
 	// should be one of the supported commands.
 	std::string cmdName = _url.substr(1);
+
+	// A persistent connection keeps its shell from one request to
+	// the next. If the client switches to another one, the old one
+	// goes away.
+	if (_shell)
+	{
+		if (cmdName == _shell_cmd) return;
+		GenericShell* old = _shell;
+		SetShell(nullptr);
+		delete old;
+		_shell_cmd.clear();
+	}
+
 	_request = _cserver.createRequest(cmdName);
 
 	// Reject URL's we don't know about.
@@ -84,17 +132,35 @@ void WebServer::OnConnection(void)
 	if (nullptr == _request)
 	{
 		logger().info("[WebServer] Request not found, trying PageServer for %s", _url.c_str());
-		std::string response = PageServer::serve(_url);
-		Send(response);
-		throw SilentException();
+		PageServer::serve(*this, _url, _if_none_match, _if_modified_since,
+		                  _accept_gzip);
+		finish_response();
+		return;
 	}
 
+	_shell_cmd = cmdName;
 	logger().info("Opened Http Socket %s Shell", cmdName.c_str());
 }
 
+// The whole response has been sent, without the help of a shell.
+// Close the connection, unless the client wants to keep it open
+// for more requests. The request body, if any, is ignored.
+void WebServer::finish_response(void)
+{
+	if (not _keep_alive)
+		throw SilentException();
+	_served = true;
+}
+
 // Called for each newline-terminated line received.
 void WebServer::OnLine(const std::string& line)
 {
+	if (_served)
+	{
+		_served = false;
+		return;
+	}
+
 	if (_request)
 	{
 		// Use the request mechanism to get a fully configured
@@ -126,30 +192,184 @@ void WebServer::OnLine(const std::string& line)
 	// Instead, get the evaluator directly and use it synchronously
 	GenericEval* eval = _shell->get_evaluator();
 
+	// Determine content type based on shell type
+	std::string content_type = "text/plain";
+	if (strcmp(_shell->_name, "mcp") == 0 || strcmp(_shell->_name, "json") == 0)
+		content_type = "application/json";
+
 	// Start evaluation
 	eval->begin_eval();
 
-	// Evaluate the expression
-	eval->eval_expr(line);
+	// Evaluate the expression right here, on the handler's thread,
+	// while a pool task forwards the output as it is produced.
+	// Sockets that don't belong to a NetworkServer have no pool;
+	// those evaluate first, and send afterwards.
+	HandlerPool* pool = get_handler_pool();
+	if (nullptr == pool)
+	{
+		evaluate(eval, line);
+		forward_output(eval, content_type);
+		return;
+	}
+
+	std::mutex mtx;
+	std::condition_variable cv;
+	bool finished = false;
+	std::exception_ptr fail;
+	pool->run([&]() {
+		try { forward_output(eval, content_type); }
+		catch (...)
+		{
+			// Most likely, the client went away. There's no
+			// point in evaluating any further.
+			fail = std::current_exception();
+			eval->interrupt();
+		}
+		std::lock_guard<std::mutex> lck(mtx);
+		finished = true;
+		cv.notify_all();
+	});
+
+	evaluate(eval, line);
 
-	// Collect all results
+	std::unique_lock<std::mutex> lck(mtx);
+	cv.wait(lck, [&finished] { return finished; });
+	if (fail) std::rethrow_exception(fail);
+}
+
+void WebServer::evaluate(GenericEval* eval, const std::string& line)
+{
+	try { eval->eval_expr(line); }
+	catch (const std::exception& ex)
+	{
+		logger().warn("[WebServer] Evaluation failed: %s", ex.what());
+		eval->interrupt();
+	}
+}
+
+// Send the output of an evaluation as the reply. poll_result()
+// blocks until there is some, or until the evaluation is done.
+void WebServer::forward_output(GenericEval* eval,
+                               const std::string& content_type)
+{
+	// Quick, short results are sent in one piece, with a
+	// Content-Length. Otherwise, the output is streamed as it
+	// arrives, so that it is not all held in memory, and the
+	// client sees the first of it right away.
+	auto start = std::chrono::steady_clock::now();
 	std::string result;
-	std::string chunk;
-	do {
-		chunk = eval->poll_result();
+	bool streaming = false;
+	while (true)
+	{
+		std::string chunk = eval->poll_result();
+		if (chunk.empty()) break;
+
+		if (streaming)
+		{
+			SendChunk(chunk);
+			continue;
+		}
+
 		result += chunk;
-	} while (!chunk.empty());
+		if (stream_cap < result.size() or
+		    stream_after < std::chrono::steady_clock::now() - start)
+		{
+			StartStream(content_type);
+			SendChunk(result);
+			result.clear();
+			result.shrink_to_fit();
+			streaming = true;
+		}
+	}
+
+	// An empty result still gets a reply, so that replies on a
+	// persistent connection can be matched up with the requests.
+	if (streaming)
+		EndStream();
+	else
+		SendWithHeader(result, content_type);
+}
 
-	// Send with appropriate HTTP headers
-	if (!result.empty())
+// Begin a streamed reply. HTTP/1.1 clients get chunked encoding.
+// HTTP/1.0 clients don't know about that; they get the data as-is,
+// and the end of it is marked by closing the connection.
+void WebServer::StartStream(const std::string& content_type)
+{
+	std::string header;
+	if (11 <= _http_version)
+		header = "HTTP/1.1 200 OK\r\n"
+			"Server: CogServer\r\n"
+			"Transfer-Encoding: chunked\r\n";
+	else
 	{
-		// Determine content type based on shell type
-		std::string content_type = "text/plain";
-		if (strcmp(_shell->_name, "mcp") == 0 || strcmp(_shell->_name, "json") == 0)
-			content_type = "application/json";
+		header = "HTTP/1.0 200 OK\r\n"
+			"Server: CogServer\r\n"
+			"Connection: close\r\n";
+		_keep_alive = false;
+	}
+#ifdef HAVE_ZLIB
+	if (_accept_gzip)
+	{
+		header += "Content-Encoding: gzip\r\n"
+			"Vary: Accept-Encoding\r\n";
+		_gzip_stream = new Deflater(Deflater::GZIP);
+	}
+#endif
+	header += "Content-Type: ";
+	header += content_type;
+	header += "\r\n\r\n";
+	Send(header);
+}
 
-		SendWithHeader(result, content_type);
+// Send one piece of a streamed reply. If it is being compressed,
+// the compressor is flushed, so that the client can show all of
+// what was sent so far.
+void WebServer::SendChunk(const std::string& data)
+{
+	if (data.empty()) return;
+#ifdef HAVE_ZLIB
+	if (_gzip_stream)
+	{
+		std::string zipped;
+		_gzip_stream->compress(data.data(), data.size(), zipped, true);
+		SendRaw(zipped);
+		return;
+	}
+#endif
+	SendRaw(data);
+}
+
+// Send data as one chunk, if chunked encoding is in use.
+void WebServer::SendRaw(const std::string& data)
+{
+	if (data.empty()) return;
+	if (_http_version < 11)
+	{
+		Send({asio::buffer(data)});
+		return;
+	}
+
+	char size[24];
+	int len = snprintf(size, sizeof(size), "%zx\r\n", data.size());
+	Send({asio::buffer(size, len), asio::buffer(data),
+	      asio::buffer("\r\n", 2)});
+}
+
+// End a streamed reply.
+void WebServer::EndStream(void)
+{
+#ifdef HAVE_ZLIB
+	if (_gzip_stream)
+	{
+		std::string tail;
+		_gzip_stream->finish(tail);
+		SendRaw(tail);
+		delete _gzip_stream;
+		_gzip_stream = nullptr;
 	}
+#endif
+	if (11 <= _http_version)
+		Send("0\r\n\r\n");
 }
 
 
@@ -161,6 +381,7 @@ std::string WebServer::html_stats(void)
 		"HTTP/1.1 200 OK\r\n"
 		"Server: CogServer\r\n"
 		"Content-Type: text/html\r\n"
+		"Connection: close\r\n"
 		"\r\n"
 		"<!DOCTYPE html>\n"
 		"<html lang=\"en\">\n"
@@ -256,7 +477,7 @@ static std::string base64_decode(const std::string &in)
 
 // ==================================================================
 
-/// Return an HTTP response holding the opencog favicon.ico image.
+/// Return the opencog favicon.ico image.
 std::string WebServer::favicon(void)
 {
 	// I do not want to open and read a file; so we're going to
@@ -268,23 +489,7 @@ std::string WebServer::favicon(void)
 	std::string bicon =
 #include "favicon.ico.base64"
 	;
-	std::string icon = base64_decode(bicon);
-
-	std::string response =
-		"HTTP/1.1 200 OK\r\n"
-		"Server: CogServer\r\n"
-		"Content-Length: ";
-
-	char buf[20];
-	snprintf(buf, 20, "%lu", icon.size());
-	response += buf;
-	response += "\r\n"
-		"Content-Type: image/vnd.microsoft.icon\r\n"
-		"\r\n";
-
-	response += icon;
-
-	return response;
+	return base64_decode(bicon);
 }
 
 #ifdef HAVE_MCP
@@ -369,21 +574,35 @@ std::string WebServer::oauth_register_not_required(void)
 // Send with HTTP headers for shell output
 void WebServer::SendWithHeader(const std::string& msg, const std::string& content_type)
 {
-	// Build HTTP response with Content-Length
-	std::string response = "HTTP/1.1 200 OK\r\n";
-	response += "Server: CogServer\r\n";
-	response += "Content-Type: ";
-	response += content_type;
-	response += "\r\n";
-	response += "Content-Length: ";
+	// Compress the reply, if the client takes that, and if it's
+	// big enough to be worth it.
+	const std::string* body = &msg;
+#ifdef HAVE_ZLIB
+	std::string zipped;
+	if (_accept_gzip and gzip_min <= msg.size())
+	{
+		zipped = Deflater::gzip(msg);
+		body = &zipped;
+	}
+#endif
+
+	// Build HTTP response header with Content-Length
+	std::string header = "HTTP/1.1 200 OK\r\n";
+	header += "Server: CogServer\r\n";
+	header += "Content-Type: ";
+	header += content_type;
+	header += "\r\n";
+	if (body != &msg)
+		header += "Content-Encoding: gzip\r\n"
+			"Vary: Accept-Encoding\r\n";
+	header += "Content-Length: ";
 	char buf[20];
-	snprintf(buf, 20, "%lu", msg.size());
-	response += buf;
-	response += "\r\n\r\n";
-	response += msg;
+	snprintf(buf, 20, "%lu", body->size());
+	header += buf;
+	header += "\r\n\r\n";
 
-	// Send the complete HTTP response
-	Send(response);
+	// Send the header and body together, without copying the body.
+	Send({asio::buffer(header), asio::buffer(*body)});
 }
 
 #endif // HAVE_OPENSSL
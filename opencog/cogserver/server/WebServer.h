@@ -20,6 +20,8 @@ namespace opencog
  *  @{
  */
 
+class GenericEval;
+
 /**
  * This class implements a super-simple WebSockets server.
  * The actual WebSockets protocol is handled in class ServerSocket.
@@ -31,13 +33,26 @@ class WebServer : public ConsoleSocket
 private:
 	CogServer& _cserver;
 	Request* _request;
+	std::string _shell_cmd;   // The command that made the shell.
+	bool _served;             // Request was answered in OnConnection.
+	Deflater* _gzip_stream;   // Compressor for a streamed reply.
+
+	void finish_response(void);
+
+	void evaluate(GenericEval*, const std::string&);
+	void forward_output(GenericEval*, const std::string&);
 
 protected:
 	virtual void OnConnection(void);
 	virtual void OnLine (const std::string&);
 
+	// HTTP requests are evaluated, and replies streamed, in OnLine().
+	// Once upgraded to a websocket, OnLine() only queues the message
+	// to the shell, and that does not block.
+	virtual bool handler_may_block(void) { return not _got_websock_header; }
+
 	std::string html_stats(void);
-	std::string favicon(void);
+	static std::string favicon(void);
 #ifdef HAVE_MCP
 	std::string oauth_protected_resource(void);
 	std::string oauth_authorization_server(void);
@@ -46,6 +61,12 @@ protected:
 
 	// Send with HTTP headers for shell output
 	void SendWithHeader(const std::string& msg, const std::string& content_type);
+
+	// Streamed shell output, for long or slow replies.
+	void StartStream(const std::string& content_type);
+	void SendChunk(const std::string&);
+	void SendRaw(const std::string&);
+	void EndStream(void);
 public:
     WebServer(const Handle&, CogServer&, SocketManager*);
     ~WebServer();
@@ -87,15 +87,21 @@ SexprShellModule::shelloutRequest::execute(void)
 	SexprShell *sh = new SexprShell(_cogserver.getHandle());
 
 	// Install cog-barrier handler for UUID-based multi-socket sync
-	// Message format: (cog-barrier N "uuid")
+	// Message format: (cog-barrier N "uuid") or (cog-barrier N "uuid" MS)
+	// The optional MS is a timeout, in millisecs, after which all
+	// waiters get an error reply.
 	SexprEval* eval = dynamic_cast<SexprEval*>(sh->get_evaluator());
 	eval->install_handler("cog-barrier",
 		[con](const std::string& args) -> std::string {
-			unsigned int n = 0;
-			char uuid[32] = {0};
-			sscanf(args.c_str(), "%u \"%31[^\"]\"", &n, uuid);
-			con->get_socket_manager()->recv_barrier(n, uuid);
-			return "";
+			size_t n = 0;
+			unsigned int ms = 0;
+			char uuid[64] = {0};
+			sscanf(args.c_str(), "%zu \"%63[^\"]\" %u", &n, uuid, &ms);
+			if (con->get_socket_manager()->recv_barrier(n, uuid, ms))
+				return "";
+			return "Error: cog-barrier \"" + std::string(uuid) +
+				"\" timed out waiting for " + std::to_string(n) +
+				" sockets\n";
 		});
 
 	// Install cog-global-barrier handler for global sync across all clients
@@ -105,6 +111,19 @@ SexprShellModule::shelloutRequest::execute(void)
 			return "";
 		});
 
+	// Install cog-output-batch handler to coalesce small replies.
+	// Message format: (cog-output-batch BYTES USECS)
+	// Replies are held until BYTES accumulate, or USECS elapse,
+	// or the shell goes idle. Zero bytes turns batching off.
+	eval->install_handler("cog-output-batch",
+		[con](const std::string& args) -> std::string {
+			size_t bytes = 0;
+			unsigned int usec = 0;
+			sscanf(args.c_str(), "%zu %u", &bytes, &usec);
+			con->set_output_batching(bytes, usec);
+			return "";
+		});
+
 	sh->set_socket(con);
 	send("");
 	return true;
@@ -31,6 +31,7 @@ class MODNAME : public Module {                                       \
                 virtual ~shelloutRequest() {};                        \
                 virtual bool execute(void);                           \
                 virtual bool isShell(void) { return true; }           \
+                virtual bool isParallel(void) { return true; }        \
         };                                                            \
         Factory<shelloutRequest, Request> shelloutFactory;            \
         EXTRA;                                                        \
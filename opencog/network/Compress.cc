@@ -0,0 +1,137 @@
+/*
+ * opencog/network/Compress.cc
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifdef HAVE_ZLIB
+
+#include <string.h>
+
+#include <opencog/util/exceptions.h>
+#include <opencog/network/Compress.h>
+
+using namespace opencog;
+
+// ==================================================================
+
+Deflater::Deflater(Format fmt, int level, int window_bits)
+{
+    memset(&_zs, 0, sizeof(_zs));
+
+    // zlib takes a negative window size for raw deflate, and adds
+    // 16 for a gzip wrapper. It no longer does raw deflate with a
+    // window of 2^8; 2^9 is what it uses for that anyway.
+    if (window_bits < 9) window_bits = 9;
+    int wbits = (GZIP == fmt) ? 16 + window_bits : -window_bits;
+    if (Z_OK != deflateInit2(&_zs, level, Z_DEFLATED, wbits, 8,
+                             Z_DEFAULT_STRATEGY))
+        throw RuntimeException(TRACE_INFO, "Cannot initialize zlib");
+}
+
+Deflater::~Deflater()
+{
+    deflateEnd(&_zs);
+}
+
+void Deflater::compress(const char* buf, size_t len,
+                        std::string& out, bool flush)
+{
+    _zs.next_in = (Bytef*) buf;
+    _zs.avail_in = len;
+
+    // Grow the output by about as much as the input, and more as
+    // needed. Text usually shrinks a lot, so this rarely loops.
+    int mode = flush ? Z_SYNC_FLUSH : Z_NO_FLUSH;
+    size_t chunk = len / 2 + 64;
+    do
+    {
+        size_t have = out.size();
+        out.resize(have + chunk);
+        _zs.next_out = (Bytef*) &out[have];
+        _zs.avail_out = chunk;
+        deflate(&_zs, mode);
+        out.resize(have + chunk - _zs.avail_out);
+        chunk = 2 * chunk + 64;
+    } while (0 == _zs.avail_out or 0 < _zs.avail_in);
+}
+
+void Deflater::finish(std::string& out)
+{
+    _zs.next_in = nullptr;
+    _zs.avail_in = 0;
+    int rc;
+    do
+    {
+        size_t have = out.size();
+        out.resize(have + 256);
+        _zs.next_out = (Bytef*) &out[have];
+        _zs.avail_out = 256;
+        rc = deflate(&_zs, Z_FINISH);
+        out.resize(have + 256 - _zs.avail_out);
+    } while (Z_OK == rc);
+}
+
+void Deflater::reset(void)
+{
+    deflateReset(&_zs);
+}
+
+std::string Deflater::gzip(const std::string& in, int level)
+{
+    Deflater gz(GZIP, level);
+    std::string out;
+    out.reserve(in.size() / 4 + 64);
+    gz.compress(in.data(), in.size(), out, false);
+    gz.finish(out);
+    return out;
+}
+
+// ==================================================================
+
+Inflater::Inflater(int window_bits)
+{
+    memset(&_zs, 0, sizeof(_zs));
+    if (Z_OK != inflateInit2(&_zs, -window_bits))
+        throw RuntimeException(TRACE_INFO, "Cannot initialize zlib");
+}
+
+Inflater::~Inflater()
+{
+    inflateEnd(&_zs);
+}
+
+bool Inflater::decompress(const char* buf, size_t len,
+                          std::string& out, size_t max)
+{
+    _zs.next_in = (Bytef*) buf;
+    _zs.avail_in = len;
+
+    size_t chunk = 4 * len + 256;
+    while (true)
+    {
+        size_t have = out.size();
+        if (max <= have) return false;
+        if (max - have < chunk) chunk = max - have;
+        out.resize(have + chunk);
+        _zs.next_out = (Bytef*) &out[have];
+        _zs.avail_out = chunk;
+        int rc = inflate(&_zs, Z_SYNC_FLUSH);
+        out.resize(have + chunk - _zs.avail_out);
+
+        if (Z_STREAM_END == rc) return true;
+        if (Z_OK != rc and Z_BUF_ERROR != rc) return false;
+
+        // If there was room to spare, then everything is out.
+        if (0 < _zs.avail_out) return 0 == _zs.avail_in;
+        chunk = 2 * chunk;
+    }
+}
+
+void Inflater::reset(void)
+{
+    inflateReset(&_zs);
+}
+
+#endif // HAVE_ZLIB
@@ -0,0 +1,81 @@
+/*
+ * opencog/network/Compress.h
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifndef _OPENCOG_COMPRESS_H
+#define _OPENCOG_COMPRESS_H
+
+#ifdef HAVE_ZLIB
+
+#include <string>
+#include <zlib.h>
+
+namespace opencog
+{
+/** \addtogroup grp_server
+ *  @{
+ */
+
+/**
+ * Streaming zlib compression. This is used in two ways: as gzip, for
+ * HTTP replies sent with `Content-Encoding: gzip`, and as raw deflate,
+ * for websocket messages sent with the `permessage-deflate` extension
+ * of RFC 7692.
+ */
+class Deflater
+{
+private:
+    z_stream _zs;
+
+public:
+    enum Format { GZIP, RAW };
+
+    Deflater(Format, int level = Z_DEFAULT_COMPRESSION,
+             int window_bits = 15);
+    ~Deflater();
+
+    /// Compress the data, appending the output to `out`. If `flush`
+    /// is set, everything is flushed out, up to a byte boundary, so
+    /// that the receiver can decompress all of it right away.
+    void compress(const char*, size_t, std::string& out, bool flush);
+
+    /// End the stream, appending the remaining output to `out`.
+    void finish(std::string& out);
+
+    /// Start over, with a fresh stream.
+    void reset(void);
+
+    /// Compress a string, in one go, as gzip.
+    static std::string gzip(const std::string&,
+                            int level = Z_DEFAULT_COMPRESSION);
+};
+
+/**
+ * Streaming raw-deflate decompression, for websocket messages.
+ */
+class Inflater
+{
+private:
+    z_stream _zs;
+
+public:
+    Inflater(int window_bits = 15);
+    ~Inflater();
+
+    /// Decompress the data, appending the output to `out`. Returns
+    /// false if the data is corrupt, or if `out` would grow past
+    /// `max` bytes.
+    bool decompress(const char*, size_t, std::string& out, size_t max);
+
+    /// Start over, with a fresh stream.
+    void reset(void);
+};
+
+/** @}*/
+}  // namespace
+
+#endif // HAVE_ZLIB
+#endif // _OPENCOG_COMPRESS_H
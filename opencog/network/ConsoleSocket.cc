@@ -67,11 +67,17 @@ bool ConsoleSocket::busyShell(void)
     return (_shell->queued() > 0 or not _shell->eval_done());
 }
 
+bool ConsoleSocket::hasShell(void)
+{
+    std::unique_lock<std::mutex> lck(_in_use_mtx);
+    return nullptr != _shell;
+}
+
 // ==================================================================
 
 std::string ConsoleSocket::connection_header(void)
 {
-    return ServerSocket::connection_header() + " U SHEL QZ E PENDG";
+    return ServerSocket::connection_header() + " U SHEL   QZ STL E PENDG";
 }
 
 std::string ConsoleSocket::connection_stats(void)
@@ -85,12 +91,13 @@ std::string ConsoleSocket::connection_stats(void)
     if (_shell)
     {
         rc += _shell->_name;
-        snprintf(buf, 40, " %2zd %c %5zd",
-            _shell->queued(), _shell->eval_done()?'F':'T',
+        snprintf(buf, 40, " %3zd%c %3zd %c %5zd",
+            _shell->queued(), _shell->throttled()?'!':' ',
+            _shell->stalls(), _shell->eval_done()?'F':'T',
             _shell->pending());
         rc += buf;
     }
-    else rc += "cogs           ";
+    else rc += "cogs                 ";
 
     return rc;
 }
@@ -81,6 +81,9 @@ public:
     /** Predicate: is there a shell, and is it busy? */
     bool busyShell(void);
 
+    /** Predicate: is there a shell? Safe to call from any thread. */
+    bool hasShell(void);
+
     /**
      * Assorted debugging utilities.
      */
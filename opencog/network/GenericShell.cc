@@ -23,6 +23,8 @@
 #include <sys/prctl.h>
 
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <mutex>
 #include <thread>
 
@@ -30,6 +32,7 @@
 #include <opencog/util/oc_assert.h>
 
 #include <opencog/network/ConsoleSocket.h>
+#include <opencog/network/OutputDispatcher.h>
 #include <opencog/network/SocketManager.h>
 #include <opencog/eval/GenericEval.h>
 #include "GenericShell.h"
@@ -67,11 +70,52 @@ using namespace opencog;
 #define CAN 0x18  // cancel or ^X at keyboard.
 #define ESC 0x1b  // ecsape or ^[ at keyboard.
 
+static thread_local GenericShell* _current_shell = nullptr;
+
+GenericShell* GenericShell::current_shell(void)
+{
+	return _current_shell;
+}
+
+/// The number of threads in this process.
+static size_t num_threads(void)
+{
+	// Field 20 of /proc/self/stat; the command name, in field 2,
+	// may hold spaces, so count from the closing paren after it.
+	FILE* fh = fopen("/proc/self/stat", "r");
+	if (nullptr == fh) return 0;
+	char buf[1024];
+	size_t len = fread(buf, 1, sizeof(buf) - 1, fh);
+	fclose(fh);
+	buf[len] = 0;
+
+	const char* p = strrchr(buf, ')');
+	if (nullptr == p) return 0;
+	long nthr = 0;
+	if (1 != sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u "
+	                "%*u %*u %*d %*d %*d %*d %ld", &nthr))
+		return 0;
+	return nthr;
+}
+
+size_t GenericShell::_q_max_cmds = 1000;
+size_t GenericShell::_q_max_bytes = 16 * 1024 * 1024;
+
+void GenericShell::set_queue_limits(size_t cmds, size_t bytes)
+{
+	_q_max_cmds = cmds;
+	_q_max_bytes = bytes;
+}
+
 GenericShell::GenericShell(void) :
     socket(nullptr),
     evalthr(nullptr),
-    pollthr(nullptr),
+    _dispatcher(nullptr),
     _init_done(false),
+    _q_bytes(0),
+    _q_throttled(false),
+    _q_stalls(0),
+    _work(0),
     abort_prompt("> "),
     normal_prompt(abort_prompt),
     pending_prompt("... "),
@@ -79,6 +123,8 @@ GenericShell::GenericShell(void) :
     show_prompt(true),
     self_destruct(false),
     apply_discipline(true),
+    _threads_left(false),
+    _nthreads(0),
     _eval_done(true),
     _evaluator(nullptr),
     _name("gnrc")
@@ -234,7 +280,12 @@ void GenericShell::user_interrupt()
 	// Failure to do so will typically result in confusing
 	// the shell user.
 	std::string junk;
-	while (not evalque.is_empty()) evalque.try_pop(junk);
+	while (not evalque.is_empty())
+	{
+		if (not evalque.try_pop(junk)) continue;
+		dequeued(junk);
+		if (not junk.empty()) work_end();
+	}
 
 	// Work around timing window, where queue was just now emptied,
 	// but the scheme evaluator has not yet started... and so the
@@ -259,6 +310,7 @@ void GenericShell::user_interrupt()
 	_evaluator->clear_pending();
 	put_output(abort_prompt);
 	finish_eval();
+	wake_poll();
 }
 
 /* ============================================================== */
@@ -478,14 +530,23 @@ void GenericShell::start_eval()
 	OC_ASSERT(_eval_done, "Bad evaluator flag state!");
 	std::unique_lock<std::mutex> lck(_eval_mtx);
 	_eval_done = false;
+	_eval_start = std::chrono::steady_clock::now();
 }
 
 void GenericShell::finish_eval()
 {
 	// Repeated control-C will send us here with _eval_done already set..
 	std::unique_lock<std::mutex> lck(_eval_mtx);
+	bool was_running = not _eval_done;
 	_eval_done = true;
 	_eval_cv.notify_all();
+	if (not was_running) return;
+
+	// The socket manager sizes its admission limit by eval latency.
+	double ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - _eval_start).count();
+	lck.unlock();
+	socket->get_socket_manager()->record_latency(ms);
 }
 
 void GenericShell::while_not_done()
@@ -511,10 +572,13 @@ void GenericShell::eval_loop(void)
 	// each invocation would end up with the same evaluator.
 	_evaluator = get_evaluator();
 	_evaluator->clear_pending();
+	_current_shell = this;
 
-	// Poll for output from the evaluator, and send back results.
-	auto poll_wrapper = [&](void) { poll_loop(); };
-	pollthr = new std::thread(poll_wrapper);
+	// Output from the evaluator is forwarded to the socket by the
+	// shared dispatcher, and not by a thread of our own.
+	_dispatcher = socket->get_socket_manager()->get_output_dispatcher();
+	_dispatcher->add(this);
+	_init_done = true;
 
 	// Derived-class initializer. (None of the shells use this
 	// at this time ... this is left over from earlier times.)
@@ -522,6 +586,7 @@ void GenericShell::eval_loop(void)
 
 	// Go through the body of the loop at least once.
 	std::string in;
+	bool running = false;
 	do
 	{
 		try
@@ -530,31 +595,40 @@ void GenericShell::eval_loop(void)
 			// has finished. Failure to do this can result in
 			// weird crashes in the SchemeEval class.
 			while_not_done();
+			if (running) { running = false; work_end(); }
 			wake_poll();
 
 			// Note that this pop will stall until the queue
 			// becomes non-empty.
 			evalque.pop(in);
+			dequeued(in);
 
 			// Skip empty strings - these are sentinel wake-up signals.
 			if (in.empty())
 				continue;
+			running = true;
 
 			logger().debug("[GenericShell] start eval %s of '%s'",
 				 _evaluator->get_name().c_str(), in.c_str());
 
-			wake_poll();
+			// Wake the dispatcher only after begin_eval(), so that it
+			// parks in poll_result(), which blocks until the evaluator
+			// has output or is finished. Results are then forwarded
+			// the moment they exist.
 			start_eval();
 			_evaluator->begin_eval();
+			wake_poll();
+			size_t nthreads = num_threads();
 			_evaluator->eval_expr(in);
+			_nthreads = nthreads;
+			_threads_left = (0 < nthreads and nthreads < num_threads());
 			wake_poll();
 		}
 		catch (const RuntimeException& ex)
 		{
 			/* Python throws these on user syntax errors.*/
-			/* Python sometimes deadlocks. Don't know why. */
-			_eval_done = true;
-			_poll_mtx.unlock();
+			finish_eval();
+			wake_poll();
 		}
 		catch (const concurrent_queue<std::string>::Canceled& ex)
 		{
@@ -569,11 +643,10 @@ void GenericShell::eval_loop(void)
 	assert(self_destruct);
 	evalque.cancel_reset();
 
-	// Let the polling thread die first. If we don't do this, it will
-	// interfere with the manual polling below.
-	pollthr->join();
-	delete pollthr;
-	pollthr = nullptr;
+	// Detach from the dispatcher first. If we don't do this, it will
+	// interfere with the manual polling below. This waits, if the
+	// dispatcher is polling us right now.
+	_dispatcher->remove(this);
 
 	// Nothing more will be queued, so we can safely loop over remainder
 	// of the queue, without any additional need for locking/waiting.
@@ -581,16 +654,17 @@ void GenericShell::eval_loop(void)
 	{
 		// As mentioned before, do not begin the next queued expr until
 		// the last has finished. Failure to do this results in crashes.
+		// No need to sleep: poll_and_send() blocks in poll_result()
+		// until the evaluator has something for us.
 		poll_and_send();
 		while (not _eval_done)
-		{
-			usleep(10000);
 			poll_and_send();
-		}
+		if (running) { running = false; work_end(); }
 
 		try
 		{
 			evalque.pop(in);
+			dequeued(in);
 		}
 		catch (const concurrent_queue<std::string>::Canceled& ex)
 		{
@@ -603,6 +677,7 @@ void GenericShell::eval_loop(void)
 			continue;
 
 		logger().debug("[GenericShell] finishing; eval of '%s'", in.c_str());
+		running = true;
 		start_eval();
 		_evaluator->begin_eval();
 		_evaluator->eval_expr(in);
@@ -611,9 +686,17 @@ void GenericShell::eval_loop(void)
 	// Continue polling until the evaluation really is done.
 	poll_and_send();
 	while (not _eval_done)
-	{
-		usleep(10000);
 		poll_and_send();
+
+	// Whatever work remains is never going to be done; don't leave
+	// barriers waiting on it.
+	{
+		std::lock_guard<std::mutex> lock(_q_mtx);
+		if (0 < _work)
+		{
+			_work = 0;
+			socket->get_socket_manager()->shell_busy(false);
+		}
 	}
 	socket->SetShell(nullptr);
 
@@ -623,63 +706,53 @@ void GenericShell::eval_loop(void)
 	logger().debug("[GenericShell] exit eval loop");
 }
 
-void GenericShell::poll_and_send(void)
+/// Forward any output to the socket. Returns true if something was
+/// sent. Blocks in poll_result() if an evaluation is in progress.
+bool GenericShell::poll_and_send(void)
 {
 	std::string retstr(poll_output());
-	if (0 < retstr.size())
+	bool sent = (0 < retstr.size());
+	if (sent)
 		socket->Send(retstr);
+
+	// If output batching is on, don't let the tail of the reply
+	// (typically, the prompt) sit in the batch once the shell has
+	// gone idle. The client is waiting on it.
+	if (_eval_done and 0 == evalque.size())
+		socket->flush_output();
+
+	return sent;
 }
 
 void GenericShell::wake_poll(void)
 {
-	std::unique_lock<std::mutex> lck(_poll_mtx);
-	_poll_cv.notify_all();
+	if (_dispatcher) _dispatcher->wake(this);
 }
 
-void GenericShell::poll_loop(void)
+/// Called by the OutputDispatcher, when it's our turn. Forward
+/// output until the current evaluation (if any) is finished.
+/// Returns true if anything was sent.
+bool GenericShell::dispatch_output(void)
 {
-	_init_done = true;
-	prctl(PR_SET_NAME, "cogserv:poll", 0, 0, 0);
-
-	std::unique_lock<std::mutex> lock(_poll_mtx);
-
-	// Poll for output from the evaluator, and send back results.
-	while (not self_destruct)
-	{
-		// That's right, call this twice in a row.
-		// This avoids a stall in the _poll_cv below.
-		poll_and_send();
-		poll_and_send();
+	// That's right, call this at least twice in a row. The
+	// second call picks up any evaluator error message.
+	bool sent = poll_and_send();
+	while (not _eval_done and not self_destruct)
+		sent = poll_and_send() or sent;
+	return poll_and_send() or sent;
+}
 
-		// Continue polling, about 100 times per second, even if
-		// evaluation of the the previous expr is completed. It
-		// might have started some long-running thread that is
-		// continuing to print, and we want to forward those
-		// prints to the user. (Its pointless to poll faster or
-		// slower than this... except ...)
-		// ... except ...
-		// Just after finishing, there might be another command in
-		// the queue, and so we want to respond to that, as soon as
-		// it seems to be done.
-		//
-		using namespace std::chrono_literals;
-		_poll_cv.wait_for(lock, 10ms);
-	}
-	lock.unlock();
-
-	// It's also possible that another thread reaches the dtor
-	// (setting self_destruct == true) shortly after an evaluation
-	// has just finished. It may then exit the loop above without
-	// polling the output, eventually causing the evalthr to stay
-	// in while_not_done() forever. So let's poll again, one more
-	// time, here.
-	usleep(250);
-	do
-	{
-		poll_and_send();
-		usleep(10000);
-	}
-	while (not _eval_done);
+/// Did the last evaluation start threads that are still running?
+/// Those might print at any time, and the evaluator has no way of
+/// telling us when they do; so the dispatcher keeps polling until
+/// they are gone. Threads started elsewhere, in the meantime, are
+/// counted too; that costs a few needless polls, and nothing more.
+bool GenericShell::threads_left(void)
+{
+	if (not _threads_left) return false;
+	if (num_threads() <= _nthreads)
+		_threads_left = false;
+	return _threads_left;
 }
 
 void GenericShell::thread_init(void)
@@ -691,8 +764,11 @@ void GenericShell::thread_init(void)
 
 void GenericShell::put_output(const std::string& s)
 {
-	std::lock_guard<std::mutex> lock(_pending_mtx);
-	_pending_output += s;
+	{
+		std::lock_guard<std::mutex> lock(_pending_mtx);
+		_pending_output += s;
+	}
+	wake_poll();
 }
 
 std::string GenericShell::get_output()
@@ -759,8 +835,58 @@ void GenericShell::enqueue_work(const std::string& expr)
 	// to queue up work onto a closed queue. This is a race, and
 	// curing that race in some other way is ... not worth the effort.
 	// The goal here is to not crash with an uncaught exception.
+	// Count the work before it becomes visible to the eval thread,
+	// else it could be finished before being counted. Empty strings
+	// are wake-up sentinels, and are never evaluated.
+	bool work = not expr.empty();
+	if (work) work_begin();
 	try { evalque.push(expr); }
-	catch (const concurrent_queue<std::string>::Canceled& ex) {}
+	catch (const concurrent_queue<std::string>::Canceled& ex)
+	{
+		if (work) work_end();
+		return;
+	}
+
+	// If the client is sending faster than we can evaluate, stop
+	// reading from the socket, until the queue drains.
+	std::lock_guard<std::mutex> lock(_q_mtx);
+	_q_bytes += expr.size();
+	if (_q_throttled) return;
+	if ((0 < _q_max_cmds and _q_max_cmds <= evalque.size()) or
+	    (0 < _q_max_bytes and _q_max_bytes <= _q_bytes))
+	{
+		_q_throttled = true;
+		_q_stalls++;
+		socket->throttle_input(true);
+	}
+}
+
+void GenericShell::work_begin(void)
+{
+	std::lock_guard<std::mutex> lock(_q_mtx);
+	if (0 == _work++)
+		socket->get_socket_manager()->shell_busy(true);
+}
+
+void GenericShell::work_end(void)
+{
+	std::lock_guard<std::mutex> lock(_q_mtx);
+	if (0 == _work) return;
+	if (0 == --_work)
+		socket->get_socket_manager()->shell_busy(false);
+}
+
+void GenericShell::dequeued(const std::string& expr)
+{
+	std::lock_guard<std::mutex> lock(_q_mtx);
+	_q_bytes -= std::min(_q_bytes, expr.size());
+	if (not _q_throttled) return;
+	if ((0 == _q_max_cmds or evalque.size() <= _q_max_cmds / 2) and
+	    (0 == _q_max_bytes or _q_bytes <= _q_max_bytes / 2))
+	{
+		_q_throttled = false;
+		socket->throttle_input(false);
+	}
 }
 
 /* ===================== END OF FILE ============================ */
@@ -23,6 +23,8 @@
 #ifndef _OPENCOG_GENERIC_SHELL_H
 #define _OPENCOG_GENERIC_SHELL_H
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <string>
@@ -51,6 +53,7 @@ namespace opencog {
 
 class ConsoleSocket;
 class GenericEval;
+class OutputDispatcher;
 
 class GenericShell
 {
@@ -60,11 +63,29 @@ class GenericShell
 
 		ConsoleSocket* socket;
 		std::thread* evalthr;
-		std::thread* pollthr;
+		OutputDispatcher* _dispatcher;
 		concurrent_queue<std::string> evalque;
 		volatile bool _init_done;
 
+		// Backpressure. Reading from the socket is paused while the
+		// eval queue is above the high watermark (in commands or in
+		// bytes), and resumed once it drains to half of that.
+		std::mutex _q_mtx;
+		size_t _q_bytes;
+		bool _q_throttled;
+		size_t _q_stalls;
+		static size_t _q_max_cmds;
+		static size_t _q_max_bytes;
+
+		// Number of exprs queued or being evaluated. The socket
+		// manager is told when this goes from zero to one and back,
+		// so that global barriers can wait for all shells to drain.
+		size_t _work;
+		void work_begin(void);
+		void work_end(void);
+
 		void enqueue_work(const std::string&);
+		void dequeued(const std::string&);
 
 	protected:
 		std::string abort_prompt;
@@ -79,16 +100,22 @@ class GenericShell
 		virtual void line_discipline(const std::string &expr);
 
 		// Concurrency handling
-		std::condition_variable _poll_cv;
-		std::mutex _poll_mtx;
 		void wake_poll();
 		void eval_loop();
-		void poll_loop();
-		void poll_and_send();
+		bool poll_and_send();
+		bool dispatch_output();
+
+		// Set if the last evaluation left threads running; these
+		// may print, and so the dispatcher keeps polling.
+		std::atomic_bool _threads_left;
+		std::atomic<size_t> _nthreads;
+		bool threads_left();
+		friend class OutputDispatcher;
 
 		std::condition_variable _eval_cv;
 		std::mutex _eval_mtx;
 		bool _eval_done;
+		std::chrono::steady_clock::time_point _eval_start;
 		GenericEval* _evaluator;
 		void start_eval();
 		void finish_eval();
@@ -120,10 +147,20 @@ class GenericShell
 		bool eval_done() const { return _eval_done; }
 		size_t pending() const { return _pending_output.size(); }
 		size_t queued() const { return evalque.size(); }
+		bool throttled() const { return _q_throttled; }
+		size_t stalls() const { return _q_stalls; }
+
+		// Eval queue high watermarks, for all shells. Zero means
+		// unlimited.
+		static void set_queue_limits(size_t cmds, size_t bytes);
 
 		// Return true if the current thread is this shell's eval thread
 		bool is_eval_thread() const
 		{ return evalthr and evalthr->get_id() == std::this_thread::get_id(); }
+
+		// The shell whose eval thread this is, else null.
+		static GenericShell* current_shell(void);
+		ConsoleSocket* get_socket(void) const { return socket; }
 };
 
 /** @}*/
@@ -0,0 +1,126 @@
+/*
+ * opencog/network/HandlerPool.cc
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <sys/prctl.h>
+#include <chrono>
+
+#include <opencog/util/Logger.h>
+#include <opencog/network/HandlerPool.h>
+#include <opencog/network/ServerSocket.h>
+
+using namespace opencog;
+
+HandlerPool::HandlerPool(size_t max_idle, unsigned int idle_secs) :
+    _nidle(0),
+    _nbusy(0),
+    _max_idle(max_idle),
+    _idle_secs(idle_secs),
+    _stop(false),
+    _nspawned(0),
+    _nreused(0)
+{
+}
+
+HandlerPool::~HandlerPool()
+{
+    stop();
+}
+
+// Join threads that have exited. Caller must hold the lock.
+void HandlerPool::reap(void)
+{
+    for (const std::thread::id& tid : _dead)
+    {
+        auto it = _threads.find(tid);
+        if (_threads.end() == it) continue;
+        it->second.join();
+        _threads.erase(it);
+    }
+    _dead.clear();
+}
+
+void HandlerPool::run(ServerSocket* ss)
+{
+    // This will `delete ss` when the connection closes.
+    run([ss]() { ss->handle_connection(); });
+}
+
+void HandlerPool::run(std::function<void(void)> task)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    reap();
+
+    _pending.push_back(std::move(task));
+
+    // Hand it to an idle thread, if there is one.
+    if (_pending.size() <= _nidle)
+    {
+        _nreused++;
+        _work_cv.notify_one();
+        return;
+    }
+
+    _nspawned++;
+    std::thread thr(&HandlerPool::worker, this);
+    std::thread::id tid = thr.get_id();
+    _threads.emplace(tid, std::move(thr));
+}
+
+void HandlerPool::worker(void)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (true)
+    {
+        if (_pending.empty())
+        {
+            if (_stop or _max_idle <= _nidle) break;
+
+            prctl(PR_SET_NAME, "cogserv:pool", 0, 0, 0);
+            _nidle++;
+            bool got = _work_cv.wait_for(lock,
+                std::chrono::seconds(_idle_secs),
+                [this] { return _stop or not _pending.empty(); });
+            _nidle--;
+            if (not got or _pending.empty()) break;
+        }
+
+        std::function<void(void)> task = std::move(_pending.front());
+        _pending.pop_front();
+        _nbusy++;
+        lock.unlock();
+
+        task();
+
+        lock.lock();
+        _nbusy--;
+    }
+
+    // Exiting. Someone else will join us.
+    _dead.push_back(std::this_thread::get_id());
+    _done_cv.notify_all();
+}
+
+void HandlerPool::stop(void)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    _stop = true;
+    _work_cv.notify_all();
+
+    logger().debug("[HandlerPool] Waiting for %zu threads", _threads.size());
+    _done_cv.wait(lock, [this] { return _dead.size() == _threads.size(); });
+    reap();
+}
+
+std::string HandlerPool::display_stats(void)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    char buff[180];
+    snprintf(buff, sizeof(buff),
+        "  pool-threads: %zu  busy: %zu  idle: %zu  spawned: %zu  reused: %zu\n",
+        _threads.size() - _dead.size(), _nbusy, _nidle, _nspawned, _nreused);
+    return buff;
+}
@@ -0,0 +1,88 @@
+/*
+ * opencog/network/HandlerPool.h
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifndef _OPENCOG_HANDLER_POOL_H
+#define _OPENCOG_HANDLER_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace opencog
+{
+/** \addtogroup grp_server
+ *  @{
+ */
+
+class ServerSocket;
+
+/**
+ * A pool of recycled threads, each running one
+ * ServerSocket::handle_connection() at a time. The Reactor also uses
+ * it, for work that must not hold up its own threads.
+ *
+ * The pool grows on demand: if there is no idle thread when a
+ * connection arrives, a new one is spawned. When a connection closes,
+ * its thread goes back to the pool and waits for the next one. Idle
+ * threads exit after a timeout, and at most `max_idle` of them are
+ * kept around. Threads that have exited are joined the next time a
+ * connection arrives, so that nothing accumulates.
+ *
+ * The total number of threads is bounded by the number of open
+ * connections (which is capped by the SocketManager) plus `max_idle`.
+ */
+class HandlerPool
+{
+private:
+    std::mutex _mtx;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+
+    std::deque<std::function<void(void)>> _pending;
+    std::map<std::thread::id, std::thread> _threads;
+    std::vector<std::thread::id> _dead;
+
+    size_t _nidle;
+    size_t _nbusy;
+    size_t _max_idle;
+    unsigned int _idle_secs;
+    bool _stop;
+
+    // Stats
+    size_t _nspawned;
+    size_t _nreused;
+
+    void worker(void);
+    void reap(void);
+
+public:
+    HandlerPool(size_t max_idle = 4, unsigned int idle_secs = 30);
+    ~HandlerPool();
+
+    /// Run `ss->handle_connection()` on a pool thread.
+    void run(ServerSocket*);
+
+    /// Run some other task on a pool thread.
+    void run(std::function<void(void)>);
+
+    /// Wait for all running connections to finish, and join all
+    /// threads. Connections should have been closed beforehand.
+    void stop(void);
+
+    /// One line of stats, newline-terminated.
+    std::string display_stats(void);
+};
+
+/** @}*/
+}  // namespace
+
+#endif // _OPENCOG_HANDLER_POOL_H
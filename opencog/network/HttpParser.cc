@@ -0,0 +1,350 @@
+/*
+ * opencog/network/HttpParser.cc
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include <opencog/network/HttpParser.h>
+
+using namespace opencog;
+
+// ==================================================================
+
+// The tchar set of RFC 9110, for methods and header names.
+static inline bool is_tchar(unsigned char c)
+{
+    if (('a' <= c and c <= 'z') or ('A' <= c and c <= 'Z') or
+        ('0' <= c and c <= '9'))
+        return true;
+    return nullptr != memchr("!#$%&'*+-.^_`|~", c, 15);
+}
+
+static inline char lower(char c)
+{
+    return ('A' <= c and c <= 'Z') ? c + ('a' - 'A') : c;
+}
+
+static bool iequals(std::string_view a, std::string_view b)
+{
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++)
+        if (lower(a[i]) != lower(b[i])) return false;
+    return true;
+}
+
+static std::string_view trim(std::string_view s)
+{
+    while (not s.empty() and (' ' == s.front() or '\t' == s.front()))
+        s.remove_prefix(1);
+    while (not s.empty() and (' ' == s.back() or '\t' == s.back()))
+        s.remove_suffix(1);
+    return s;
+}
+
+// Does the comma-separated list hold the token? Ignores case.
+static bool has_token(std::string_view list, std::string_view tok)
+{
+    while (not list.empty())
+    {
+        size_t comma = list.find(',');
+        if (iequals(trim(list.substr(0, comma)), tok)) return true;
+        if (std::string_view::npos == comma) break;
+        list.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+// Does the Accept-Encoding list allow the coding? It does if it is
+// listed, or if `*` is, without a quality value of zero.
+static bool accepts(std::string_view list, std::string_view coding)
+{
+    bool ok = false;
+    while (not list.empty())
+    {
+        size_t comma = list.find(',');
+        std::string_view item = trim(list.substr(0, comma));
+        size_t semi = item.find(';');
+        std::string_view name = trim(item.substr(0, semi));
+        if (iequals(name, coding) or "*" == name)
+        {
+            // A q-value made of zeros turns the coding off.
+            bool zero = false;
+            if (std::string_view::npos != semi)
+            {
+                std::string_view q = trim(item.substr(semi + 1));
+                if (2 < q.size() and ('q' == q[0] or 'Q' == q[0]) and '=' == q[1])
+                    zero = (q.substr(2).find_first_not_of("0.") ==
+                            std::string_view::npos);
+            }
+            if (iequals(name, coding)) return not zero;
+            ok = not zero;
+        }
+        if (std::string_view::npos == comma) break;
+        list.remove_prefix(comma + 1);
+    }
+    return ok;
+}
+
+// Next line, without the line ending. Returns false if there is
+// no line ending in the buffer.
+static bool next_line(const char* buf, size_t len, size_t& pos,
+                      std::string_view& line)
+{
+    const char* nl = (const char*) memchr(buf + pos, '\n', len - pos);
+    if (nullptr == nl) return false;
+    size_t end = nl - buf;
+    size_t n = end - pos;
+    if (0 < n and '\r' == buf[end - 1]) n--;
+    line = std::string_view(buf + pos, n);
+    pos = end + 1;
+    return true;
+}
+
+// ==================================================================
+
+void HttpRequest::clear(void)
+{
+    method = std::string_view();
+    target = std::string_view();
+    version = 0;
+    nfields = 0;
+    host = std::string_view();
+    websocket_key = std::string_view();
+    websocket_extensions = std::string_view();
+    if_none_match = std::string_view();
+    if_modified_since = std::string_view();
+    content_length = 0;
+    chunked = false;
+    keep_alive = false;
+    upgrade_websocket = false;
+    accept_gzip = false;
+    header_length = 0;
+}
+
+HttpRequest::Result HttpRequest::parse(const char* buf, size_t len)
+{
+    clear();
+
+    // A client may send blank lines ahead of the request line.
+    size_t pos = 0;
+    while (pos < len and ('\r' == buf[pos] or '\n' == buf[pos])) pos++;
+
+    // Running out of buffer is not an error, unless the header is
+    // already bigger than anything we are willing to take.
+    Result more = (len < MAX_HEADER_BYTES) ? INCOMPLETE : TOO_LARGE;
+
+    // The request line: method, target and version.
+    std::string_view line;
+    if (not next_line(buf, len, pos, line)) return more;
+
+    size_t sp = line.find(' ');
+    if (0 == sp or std::string_view::npos == sp) return BAD;
+    method = line.substr(0, sp);
+    for (char c : method)
+        if (not is_tchar(c)) return BAD;
+
+    line.remove_prefix(sp + 1);
+    sp = line.find(' ');
+    if (0 == sp or std::string_view::npos == sp) return BAD;
+    target = line.substr(0, sp);
+
+    std::string_view ver = line.substr(sp + 1);
+    if ("HTTP/1.1" == ver) version = 11;
+    else if ("HTTP/1.0" == ver) version = 10;
+    else return BAD;
+
+    // Header fields, up to the blank line.
+    bool have_length = false;
+    bool conn_close = false;
+    bool conn_keep_alive = false;
+    while (true)
+    {
+        if (not next_line(buf, len, pos, line)) return more;
+        if (line.empty()) break;
+
+        // Line folding is obsolete; RFC 9112 allows rejecting it.
+        if (' ' == line[0] or '\t' == line[0]) return BAD;
+
+        size_t colon = line.find(':');
+        if (0 == colon or std::string_view::npos == colon) return BAD;
+        std::string_view name = line.substr(0, colon);
+        for (char c : name)
+            if (not is_tchar(c)) return BAD;
+        std::string_view value = trim(line.substr(colon + 1));
+
+        if (MAX_HEADERS <= nfields) return TOO_LARGE;
+        fields[nfields++] = {name, value};
+
+        // Pick out the fields that we care about. Switch on the
+        // length first, to avoid most of the string compares.
+        switch (name.size())
+        {
+            case 4:
+                if (iequals(name, "host")) host = value;
+                break;
+            case 7:
+                if (iequals(name, "upgrade") and has_token(value, "websocket"))
+                    upgrade_websocket = true;
+                break;
+            case 10:
+                if (iequals(name, "connection"))
+                {
+                    if (has_token(value, "close")) conn_close = true;
+                    if (has_token(value, "keep-alive")) conn_keep_alive = true;
+                }
+                break;
+            case 13:
+                if (iequals(name, "if-none-match")) if_none_match = value;
+                break;
+            case 14:
+                if (iequals(name, "content-length"))
+                {
+                    if (value.empty()) return BAD;
+                    size_t n = 0;
+                    for (char c : value)
+                    {
+                        if (c < '0' or '9' < c) return BAD;
+                        if ((SIZE_MAX - 9) / 10 < n) return BAD;
+                        n = 10 * n + (c - '0');
+                    }
+                    // Repeats are allowed only if they agree.
+                    if (have_length and n != content_length) return BAD;
+                    if (MAX_BODY_BYTES < n) return BODY_TOO_LARGE;
+                    content_length = n;
+                    have_length = true;
+                }
+                break;
+            case 15:
+                if (iequals(name, "accept-encoding"))
+                    accept_gzip = accepts(value, "gzip");
+                break;
+            case 17:
+                if (iequals(name, "transfer-encoding"))
+                {
+                    // Only chunked is supported, and it must come last.
+                    size_t comma = value.rfind(',');
+                    std::string_view last = (std::string_view::npos == comma) ?
+                        value : trim(value.substr(comma + 1));
+                    if (not iequals(last, "chunked")) return NOT_IMPLEMENTED;
+                    chunked = true;
+                }
+                else if (iequals(name, "sec-websocket-key"))
+                    websocket_key = value;
+                else if (iequals(name, "if-modified-since"))
+                    if_modified_since = value;
+                break;
+            case 24:
+                if (iequals(name, "sec-websocket-extensions"))
+                    websocket_extensions = value;
+                break;
+            default:
+                break;
+        }
+    }
+
+    header_length = pos;
+    if (MAX_HEADER_BYTES < header_length) return TOO_LARGE;
+
+    // Both framings at once are a known request-smuggling trick.
+    if (chunked and have_length) return BAD;
+
+    // HTTP/1.1 connections persist, unless asked not to; HTTP/1.0
+    // connections do not, unless asked to.
+    if (11 == version)
+        keep_alive = not conn_close;
+    else
+        keep_alive = conn_keep_alive and not conn_close;
+
+    return COMPLETE;
+}
+
+std::string_view HttpRequest::header(std::string_view name) const
+{
+    for (size_t i = 0; i < nfields; i++)
+        if (iequals(fields[i].name, name)) return fields[i].value;
+    return std::string_view();
+}
+
+// ==================================================================
+
+HttpRequest::Result HttpChunkDecoder::decode(char* buf, size_t len,
+                                             size_t& body_length,
+                                             size_t& consumed)
+{
+    while (true)
+    {
+        std::string_view line;
+        size_t pos = _in;
+        if (not next_line(buf, len, pos, line))
+        {
+            // A chunk-size or trailer line should never be long.
+            return (len - _in < 4096) ? HttpRequest::INCOMPLETE
+                                      : HttpRequest::BAD;
+        }
+
+        // Everything in the buffer up to here stays there until the
+        // whole body is in; bound the framing, as well as the body.
+        if (_max < pos - _out) return HttpRequest::BODY_TOO_LARGE;
+
+        // After the last chunk, trailer fields are skipped, up to
+        // the blank line that ends the body.
+        if (_in_trailer)
+        {
+            _in = pos;
+            if (not line.empty()) continue;
+            body_length = _out;
+            consumed = _in;
+            return HttpRequest::COMPLETE;
+        }
+
+        // The chunk size is in hex, optionally followed by extensions,
+        // which are ignored.
+        size_t n = 0;
+        size_t i = 0;
+        for (; i < line.size(); i++)
+        {
+            char c = lower(line[i]);
+            int d;
+            if ('0' <= c and c <= '9') d = c - '0';
+            else if ('a' <= c and c <= 'f') d = c - 'a' + 10;
+            else break;
+            if ((SIZE_MAX >> 4) < n) return HttpRequest::BAD;
+            n = (n << 4) | d;
+        }
+        if (0 == i) return HttpRequest::BAD;
+        std::string_view rest = trim(line.substr(i));
+        if (not rest.empty() and ';' != rest[0]) return HttpRequest::BAD;
+
+        if (0 == n)
+        {
+            _in = pos;
+            _in_trailer = true;
+            continue;
+        }
+
+        // Don't wait for a chunk that would not be accepted anyway.
+        if (_max - _out < n) return HttpRequest::BODY_TOO_LARGE;
+
+        // Wait for all of the chunk data, and the line ending after it.
+        if (len - pos <= n) return HttpRequest::INCOMPLETE;
+        size_t end = pos + n;
+        size_t eol;
+        if ('\n' == buf[end]) eol = 1;
+        else if ('\r' == buf[end])
+        {
+            if (len - end < 2) return HttpRequest::INCOMPLETE;
+            if ('\n' != buf[end + 1]) return HttpRequest::BAD;
+            eol = 2;
+        }
+        else return HttpRequest::BAD;
+
+        // Move the data down, next to the data from earlier chunks.
+        memmove(buf + _out, buf + pos, n);
+        _out += n;
+        _in = end + eol;
+    }
+}
@@ -0,0 +1,131 @@
+/*
+ * opencog/network/HttpParser.h
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifndef _OPENCOG_HTTP_PARSER_H
+#define _OPENCOG_HTTP_PARSER_H
+
+#include <stddef.h>
+#include <string_view>
+
+namespace opencog
+{
+/** \addtogroup grp_server
+ *  @{
+ */
+
+/**
+ * An HTTP/1.x request header, parsed in a single pass.
+ *
+ * Parsing does not allocate, and does not copy: all of the fields are
+ * views into the buffer that was parsed, and are valid only as long
+ * as it is. Header names are matched without regard to case. The
+ * headers that the server cares about are picked out as they go by;
+ * all of them are kept, and can be looked up with header().
+ */
+class HttpRequest
+{
+public:
+    enum Result
+    {
+        COMPLETE,          // A full header was parsed.
+        INCOMPLETE,        // More data is needed.
+        BAD,               // Malformed; answer 400 Bad Request.
+        TOO_LARGE,         // Answer 431 Request Header Fields Too Large.
+        BODY_TOO_LARGE,    // Answer 413 Content Too Large.
+        NOT_IMPLEMENTED,   // Answer 501 Not Implemented.
+    };
+
+    static constexpr size_t MAX_HEADERS = 64;
+    static constexpr size_t MAX_HEADER_BYTES = 65536;
+
+    // The body is buffered whole before it is handed on; this bounds
+    // the memory that a client can make us use.
+    static constexpr size_t MAX_BODY_BYTES = 64 * 1024 * 1024;
+
+    struct Field
+    {
+        std::string_view name;
+        std::string_view value;
+    };
+
+    std::string_view method;
+    std::string_view target;
+    int version;                  // 10 or 11, for HTTP/1.0 and 1.1
+
+    Field fields[MAX_HEADERS];
+    size_t nfields;
+
+    // Picked out while parsing.
+    std::string_view host;
+    std::string_view websocket_key;
+    std::string_view websocket_extensions;
+    std::string_view if_none_match;
+    std::string_view if_modified_since;
+    size_t content_length;
+    bool chunked;
+    bool keep_alive;
+    bool upgrade_websocket;
+    bool accept_gzip;             // Accept-Encoding allows gzip
+
+    // The length of the header, including the blank line at the end.
+    size_t header_length;
+
+    HttpRequest(void) { clear(); }
+    void clear(void);
+
+    /**
+     * Parse the request line and header fields at the start of the
+     * buffer. The buffer may hold more than one request; parsing
+     * stops at the blank line that ends the header.
+     */
+    Result parse(const char* buf, size_t len);
+
+    /// Look up a header field by name, ignoring case. Returns an
+    /// empty view if there is no such field.
+    std::string_view header(std::string_view name) const;
+};
+
+/**
+ * Decoder for a request body sent with `Transfer-Encoding: chunked`.
+ *
+ * The chunks are decoded in place: the data in each chunk is moved
+ * down, so that the body ends up contiguous at the start of the buffer.
+ * Decoding is incremental: it can be called again each time more data
+ * arrives, and resumes where it left off. Offsets are kept relative to
+ * the start of the buffer, so the buffer may be moved between calls.
+ * A body longer than the limit given to the ctor is refused with
+ * BODY_TOO_LARGE, as soon as a chunk size says it will be; so is a
+ * body with more framing (chunk-size lines and trailers) than that.
+ */
+class HttpChunkDecoder
+{
+private:
+    size_t _in;        // Offset of the next unparsed byte.
+    size_t _out;       // Length of the decoded body so far.
+    bool _in_trailer;  // Skipping trailer fields after the last chunk.
+    size_t _max;       // Limit on the decoded body, and on the framing.
+
+public:
+    HttpChunkDecoder(size_t max_body = HttpRequest::MAX_BODY_BYTES) :
+        _max(max_body) { reset(); }
+    void reset(void) { _in = 0; _out = 0; _in_trailer = false; }
+
+    /**
+     * Decode as much as possible of the chunked body at the start of
+     * the buffer. Returns COMPLETE when the last chunk and trailer
+     * have been seen; then `body_length` is the length of the decoded
+     * body, and `consumed` is the number of encoded bytes that were
+     * used up.
+     */
+    HttpRequest::Result decode(char* buf, size_t len,
+                               size_t& body_length, size_t& consumed);
+};
+
+/** @}*/
+}  // namespace
+
+#endif // _OPENCOG_HTTP_PARSER_H
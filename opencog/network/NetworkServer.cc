@@ -8,13 +8,17 @@
  * SPDX-License-Identifier: AGPL-3.0-or-later
  */
 
+#include <errno.h>
+#include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <string.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
+#include <unistd.h>
 
 #include <asio/ip/tcp.hpp>
 #include <opencog/util/Logger.h>
@@ -25,38 +29,94 @@
 
 using namespace opencog;
 
-NetworkServer::NetworkServer(unsigned short port, const char* name, SocketManager* mgr) :
+/// Open a listening socket on the given port. If `reuseport` is set,
+/// then several sockets can be bound to the same port, and the kernel
+/// will distribute incoming connections between them.
+/// Throws std::system_error on failure.
+static int open_listener(int family, unsigned short port, bool reuseport)
+{
+    int fd = socket(family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "socket");
+
+    int flags = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flags, sizeof(flags));
+    if (reuseport)
+    {
+        flags = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flags, sizeof(flags));
+    }
+
+    int rc;
+    if (AF_INET6 == family)
+    {
+        // Dual-stack: accept IPv4 connections as well.
+        flags = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &flags, sizeof(flags));
+
+        struct sockaddr_in6 addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin6_family = AF_INET6;
+        addr.sin6_addr = in6addr_any;
+        addr.sin6_port = htons(port);
+        rc = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    }
+    else
+    {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port);
+        rc = bind(fd, (struct sockaddr*) &addr, sizeof(addr));
+    }
+
+    if (0 == rc)
+        rc = ::listen(fd, SOMAXCONN);
+
+    if (rc)
+    {
+        int norr = errno;
+        close(fd);
+        throw std::system_error(norr, std::generic_category(), "bind");
+    }
+    return fd;
+}
+
+NetworkServer::NetworkServer(unsigned short port, const char* name,
+                             SocketManager* mgr, int nshards) :
     _name(name),
     _port(port),
     _running(false),
-    _acceptor(_io_service),
+    _ipv6(true),
+    _reactor(nullptr),
     _socket_manager(mgr)
 {
     logger().debug("[NetworkServer] constructor for %s at %d", name, port);
 
+    if (nshards < 0) nshards = std::thread::hardware_concurrency();
+    if (nshards < 1) nshards = 1;
+
+    // SO_REUSEPORT only when sharding. Otherwise, we want the bind
+    // to fail, if some other process is already using the port.
+    bool reuse = (1 < nshards);
+
     // Try IPv6 dual-stack mode first (accepts both IPv6 and IPv4)
-    bool ipv6_success = false;
+    int fd = -1;
     try {
-        _acceptor.open(asio::ip::tcp::v6());
-        _acceptor.set_option(asio::socket_base::reuse_address(true));
-        _acceptor.set_option(asio::ip::v6_only(false));
-        _acceptor.bind(asio::ip::tcp::endpoint(asio::ip::tcp::v6(), port));
-        _acceptor.listen();
+        fd = open_listener(AF_INET6, port, reuse);
         logger().info("[NetworkServer] dual-stack IPv4/IPv6 mode enabled");
-        ipv6_success = true;
     }
     catch (const std::system_error& e) {
         logger().info("[NetworkServer] IPv6 not available (%s), falling back to IPv4-only mode",
                       e.what());
+        _ipv6 = false;
     }
 
     // Fall back to IPv4-only if IPv6 failed
-    if (!ipv6_success) {
+    if (fd < 0) {
         try {
-            _acceptor.open(asio::ip::tcp::v4());
-            _acceptor.set_option(asio::socket_base::reuse_address(true));
-            _acceptor.bind(asio::ip::tcp::endpoint(asio::ip::tcp::v4(), port));
-            _acceptor.listen();
+            fd = open_listener(AF_INET, port, reuse);
             logger().info("[NetworkServer] IPv4-only mode enabled");
         }
         catch (const std::system_error& e) {
@@ -65,9 +125,36 @@ NetworkServer::NetworkServer(unsigned short port, const char* name, SocketManage
         }
     }
 
+    // The remaining shards use the same address family as the first.
+    while (true)
+    {
+        Shard* sh = new Shard;
+        sh->fd = fd;
+        sh->thread = nullptr;
+        sh->nconnections = 0;
+        _shards.push_back(sh);
+        if ((int) _shards.size() == nshards) break;
+
+        try {
+            fd = open_listener(_ipv6 ? AF_INET6 : AF_INET, port, true);
+        }
+        catch (const std::system_error& e) {
+            logger().error("[NetworkServer] Failed to bind shard %zu to port %d: %s",
+                           _shards.size(), port, e.what());
+            for (Shard* s : _shards) { close(s->fd); delete s; }
+            _shards.clear();
+            throw;
+        }
+    }
+    if (1 < nshards)
+        logger().info("[NetworkServer] %s port %d bound %d times",
+                      name, port, nshards);
+
     _start_time = time(nullptr);
     _last_connect = 0;
     _nconnections = 0;
+
+    _socket_manager->add_stats_source(this, [this]() { return display_stats(); });
 }
 
 NetworkServer::~NetworkServer()
@@ -75,8 +162,16 @@ NetworkServer::~NetworkServer()
     logger().debug("[NetworkServer] enter destructor for %s at %d",
                    _name.c_str(), _port);
 
+    _socket_manager->rem_stats_source(this);
     stop_listening();
     join_threads();
+    delete _reactor;
+
+    for (Shard* sh : _shards)
+    {
+        close(sh->fd);
+        delete sh;
+    }
 
     logger().debug("[NetworkServer] all threads joined, exit destructor");
 }
@@ -86,73 +181,141 @@ void NetworkServer::stop_listening()
     if (not _running) return;
     _running = false;
     _socket_manager->network_gone();
-
-    std::error_code ec;
-    _acceptor.cancel(ec);
     _io_service.stop();
 
-    // asio hangs, despite the above.  Brute-force it to
-    // get it's head out of it's butt, and do the right thing.
-    pthread_cancel(_listener_thread->native_handle());
+    // Shutting down a listening socket kicks the listener thread
+    // out of accept(). The fd itself is closed in the dtor.
+    for (Shard* sh : _shards)
+        shutdown(sh->fd, SHUT_RDWR);
 
-    _listener_thread->join();
-    delete _listener_thread;
-    _listener_thread = nullptr;
+    for (Shard* sh : _shards)
+    {
+        if (nullptr == sh->thread) continue;
+        sh->thread->join();
+        delete sh->thread;
+        sh->thread = nullptr;
+    }
 }
 
 void NetworkServer::join_threads()
 {
-    // Join all connection handler threads to ensure complete shutdown.
-    // This guarantees all TCP/IP packets have been processed and all
-    // handler threads have finished before serverLoop() returns.
-    logger().debug("[NetworkServer] Joining %zu handler threads",
-                   _handler_threads.size());
+    // Reactor sockets were shut down by network_gone(); stopping
+    // the reactor closes out whatever is left. This is done first,
+    // since the reactor tears sockets down on pool threads.
+    if (_reactor) _reactor->stop();
+
+    // Wait for all connection handlers to finish, to ensure complete
+    // shutdown. This guarantees all TCP/IP packets have been processed
+    // and all handler threads have finished before serverLoop() returns.
+    _pool.stop();
+
+    logger().debug("[NetworkServer] All handler threads joined");
+}
+
+void NetworkServer::use_reactor(unsigned int nthreads)
+{
+    if (_running) return;
+    delete _reactor;
+    _reactor = nullptr;
+    if (0 == nthreads) return;
+
+    _reactor = new Reactor(nthreads, &_pool);
+    logger().info("[NetworkServer] %s using reactor with %u threads",
+                  _name.c_str(), nthreads);
+}
+
+void NetworkServer::defer_accept(int secs)
+{
+    for (Shard* sh : _shards)
+        setsockopt(sh->fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, &secs, sizeof(secs));
+}
 
-    std::list<std::thread*> threads_to_join;
+std::string NetworkServer::display_stats(void)
+{
+    char tbuf[40];
+    tbuf[0] = 0;
+    time_t last = _last_connect;
+    if (last)
     {
-        std::lock_guard<std::mutex> lock(_handler_threads_mtx);
-        threads_to_join.swap(_handler_threads);
+        struct tm tm;
+        gmtime_r(&last, &tm);
+        strftime(tbuf, 40, "%d %b %H:%M:%S", &tm);
     }
 
-    for (std::thread* thr : threads_to_join)
+    char buff[180];
+    snprintf(buff, sizeof(buff),
+        "%s port %d  tot-cnct: %zu  last: %s\n",
+        _name.c_str(), _port, _nconnections.load(), last ? tbuf : "never");
+    std::string rc = buff;
+
+    if (_reactor)
     {
-        thr->join();
-        delete thr;
+        snprintf(buff, sizeof(buff), "  reactor-threads: %zu  sockets: %zu\n",
+            _reactor->num_threads(), _reactor->num_sockets());
+        rc += buff;
     }
+    else
+        rc += _pool.display_stats();
 
-    logger().debug("[NetworkServer] All handler threads joined");
+    if (_shards.size() <= 1) return rc;
+
+    rc += "  shard-cnct:";
+    for (Shard* sh : _shards)
+        rc += " " + std::to_string(sh->nconnections.load());
+    rc += "\n";
+    return rc;
 }
 
-void NetworkServer::listen(void)
+void NetworkServer::listen(Shard* sh)
 {
     prctl(PR_SET_NAME, "cogserv:listen", 0, 0, 0);
-    printf("%s listening on port %d\n", _name.c_str(), _port);
+    if (sh == _shards[0])
+        printf("%s listening on port %d\n", _name.c_str(), _port);
+
+    const asio::ip::tcp proto = _ipv6 ? asio::ip::tcp::v6() : asio::ip::tcp::v4();
     while (_running)
     {
-        // The call to _acceptor.accept() will block this thread until
-        // a network connection is made. Thus, we defer the creation
-        // of the connection handler thread until after accept()
-        // returns.  However, the asio design violates RAII principles,
-        // so instead, what we do is to hand off the socket created here,
-        // to the ServerSocket class, which will delete it, when the
-        // connection socket closes (just before the connection handler
-        // thread exits).  That is why there is no delete of the *ss
-        // below, and that is why there is the weird self-delete at the
-        // end of ServerSocket::handle_connection().
-        asio::ip::tcp::socket* sock = new asio::ip::tcp::socket(_io_service);
-
-        _acceptor.accept(*sock);
+        // The call to accept4() will block this thread until a network
+        // connection is made. Thus, we defer the creation of the
+        // connection handler thread until after accept() returns.
+        int fd = accept4(sh->fd, nullptr, nullptr, SOCK_CLOEXEC);
 
         // Exit, if cogserver is being shut down.
-        if (not _running) break;
+        if (not _running)
+        {
+            if (0 <= fd) close(fd);
+            break;
+        }
+
+        if (fd < 0)
+        {
+            // Transient errors; the client went away, or we are
+            // out of file descriptors. Back off a little, then retry.
+            // Pending network errors on the new connection are
+            // reported by accept4(), too; see accept4(2). Those are
+            // the client's problem, and not the listener's.
+            if (EINTR == errno or ECONNABORTED == errno or EAGAIN == errno or
+                EPROTO == errno or ENOPROTOOPT == errno or
+                EHOSTDOWN == errno or ENONET == errno or
+                EHOSTUNREACH == errno or EOPNOTSUPP == errno or
+                ENETUNREACH == errno or ENETDOWN == errno)
+                continue;
+            if (EMFILE == errno or ENFILE == errno or
+                ENOBUFS == errno or ENOMEM == errno)
+            {
+                logger().warn("[NetworkServer] accept: %s", strerror(errno));
+                usleep(10000);
+                continue;
+            }
+            logger().error("[NetworkServer] %s accept failed: %s",
+                           _name.c_str(), strerror(errno));
+            break;
+        }
 
+        sh->nconnections++;
         _nconnections++;
         _last_connect = time(nullptr);
 
-        asio::ip::tcp::no_delay ndly(true);
-        sock->set_option(ndly);
-
-        int fd = sock->native_handle();
         // We are going to be sending oceans of tiny packets,
         // and we want the fastest-possible responses.
         int flags = 1;
@@ -160,18 +323,50 @@ void NetworkServer::listen(void)
         flags = 1;
         setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &flags, sizeof(flags));
 
+        // The asio design violates RAII principles, so instead, what
+        // we do is to hand off the socket created here, to the
+        // ServerSocket class, which will delete it, when the
+        // connection socket closes (just before the connection handler
+        // thread exits).  That is why there is no delete of the *ss
+        // below, and that is why there is the weird self-delete at the
+        // end of ServerSocket::handle_connection().
+        asio::ip::tcp::socket* sock = new asio::ip::tcp::socket(_io_service);
+        try
+        {
+            sock->assign(proto, fd);
+        }
+        catch (const std::system_error& e)
+        {
+            logger().warn("[NetworkServer] cannot use socket: %s", e.what());
+            close(fd);
+            delete sock;
+            continue;
+        }
+
         // The total number of concurrently open sockets is managed by
-        // the SocketManager, which blocks when there are too many.
+        // the SocketManager. It starts the connection right away, if
+        // there's room, else parks it until there is, or turns it away
+        // if the server is overloaded. The listener never blocks here.
         ServerSocket* ss = _getServer(_socket_manager);
         ss->set_connection(sock);
+        ss->set_handler_pool(&_pool);
+        _socket_manager->admit(ss,
+            [this](ServerSocket* s) { start_handler(s); });
+    }
+}
 
-        // Create handler thread and track it for proper cleanup.
-        std::thread* handler_thread = new std::thread(&ServerSocket::handle_connection, ss);
-        {
-            std::lock_guard<std::mutex> lock(_handler_threads_mtx);
-            _handler_threads.push_back(handler_thread);
-        }
+/// Begin reading from an admitted connection.
+void NetworkServer::start_handler(ServerSocket* ss)
+{
+    // In reactor mode, the reactor threads do all the reading.
+    if (_reactor)
+    {
+        _reactor->add(ss);
+        return;
     }
+
+    // Run the handler on a recycled thread.
+    _pool.run(ss);
 }
 
 void NetworkServer::run(std::function<ServerSocket*(SocketManager*)> handler)
@@ -180,13 +375,8 @@ void NetworkServer::run(std::function<ServerSocket*(SocketManager*)> handler)
     _running = true;
     _getServer = handler;
 
-    try {
-        _io_service.run();
-    } catch (const std::system_error& e) {
-        logger().error("Error in asio io_service::run() => %s", e.what());
-    }
-
-    _listener_thread = new std::thread(&NetworkServer::listen, this);
+    for (Shard* sh : _shards)
+        sh->thread = new std::thread(&NetworkServer::listen, this, sh);
 }
 
 // ==================================================================
@@ -16,8 +16,11 @@
 #include <queue>
 #include <string>
 #include <thread>
+#include <vector>
 
 #include <asio.hpp>
+#include <opencog/network/HandlerPool.h>
+#include <opencog/network/Reactor.h>
 #include <opencog/network/ServerSocket.h>
 #include <opencog/network/SocketManager.h>
 
@@ -42,6 +45,11 @@ namespace opencog
  * (server sockets bind to all interfaces in dual-stack mode, accepting both
  * IPv4 and IPv6 connections). Thus, server sockets are identified/selected
  * by the port they bind to.
+ *
+ * The port may be bound several times over, with SO_REUSEPORT, so
+ * that several listener threads can accept connections in parallel.
+ * The kernel spreads incoming connections across these "shards".
+ * This helps when many clients connect all at once.
  */
 class NetworkServer
 {
@@ -50,32 +58,50 @@ protected:
     short _port;
     std::atomic_bool _running;
     asio::io_context _io_service;
-    asio::ip::tcp::acceptor _acceptor;
-    std::thread* _listener_thread;
 
-    /** Track all handler threads for proper cleanup */
-    std::mutex _handler_threads_mtx;
-    std::list<std::thread*> _handler_threads;
+    /** One listening socket and accept thread per shard. */
+    struct Shard
+    {
+        int fd;
+        std::thread* thread;
+        std::atomic_size_t nconnections;
+    };
+    std::vector<Shard*> _shards;
+    bool _ipv6;
+
+    /** Recycled threads that run the connection handlers */
+    HandlerPool _pool;
+
+    /** If not null, connections are handed to the reactor, instead
+     *  of getting a handler thread of their own. */
+    Reactor* _reactor;
 
     /** Socket manager for tracking and managing all sockets (shared across all servers) */
     SocketManager* _socket_manager;
 
-    /** The network server's main listener thread.  */
-    void listen();
+    /** The network server's listener threads, one per shard.  */
+    void listen(Shard*);
+    void start_handler(ServerSocket*);
     std::function<ServerSocket*(SocketManager*)> _getServer;
 
     /** monitoring stats */
     time_t _start_time;
-    time_t _last_connect;
-    size_t _nconnections;
+    std::atomic<time_t> _last_connect;
+    std::atomic_size_t _nconnections;
+    std::string display_stats(void);
 
 public:
 
     /**
      * Starts the NetworkServer in a new thread.
      * The socket listen happens in the new thread.
+     *
+     * The port is bound `nshards` times, each with its own listener
+     * thread. Zero or one gives a single listener; a negative number
+     * gives one listener per CPU core.
      */
-    NetworkServer(unsigned short port, const char* name, SocketManager* mgr);
+    NetworkServer(unsigned short port, const char* name,
+                  SocketManager* mgr, int nshards = 1);
     ~NetworkServer();
 
     /** Start and stop the server */
@@ -83,6 +109,22 @@ public:
     void stop_listening();
     void join_threads();
 
+    /**
+     * Use a Reactor with `nthreads` threads to handle all connections,
+     * instead of creating one thread per connection. Must be called
+     * before run(). Zero restores thread-per-connection.
+     */
+    void use_reactor(unsigned int nthreads);
+    Reactor* get_reactor() { return _reactor; }
+
+    /**
+     * Do not wake up the listener until the client has sent some
+     * data, or `secs` seconds have passed (TCP_DEFER_ACCEPT). Only
+     * suitable for protocols where the client speaks first, e.g.
+     * HTTP. Telnet clients wait for a prompt, so don't use it there.
+     */
+    void defer_accept(int secs);
+
     /** Get the socket manager */
     SocketManager* get_socket_manager() { return _socket_manager; }
 
@@ -0,0 +1,229 @@
+/*
+ * opencog/network/OutputDispatcher.cc
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <sys/prctl.h>
+#include <algorithm>
+
+#include <opencog/util/Logger.h>
+#include <opencog/network/GenericShell.h>
+#include <opencog/network/OutputDispatcher.h>
+
+using namespace opencog;
+
+// Re-poll intervals for idle shells that left threads running.
+// Start fast, just after an evaluation, and back off while the
+// shell stays quiet.
+static constexpr std::chrono::milliseconds min_idle(10);
+static constexpr std::chrono::milliseconds max_idle(1000);
+
+OutputDispatcher::OutputDispatcher(size_t max_idle, unsigned int idle_secs) :
+    _nidle(0),
+    _nbusy(0),
+    _max_idle(max_idle),
+    _idle_secs(idle_secs),
+    _stop(false),
+    _ndispatched(0),
+    _max_ready(0)
+{
+}
+
+OutputDispatcher::~OutputDispatcher()
+{
+    stop();
+}
+
+// Join threads that have exited. Caller must hold the lock.
+void OutputDispatcher::reap(void)
+{
+    for (const std::thread::id& tid : _dead)
+    {
+        auto it = _threads.find(tid);
+        if (_threads.end() == it) continue;
+        it->second.join();
+        _threads.erase(it);
+    }
+    _dead.clear();
+}
+
+// Caller must hold the lock.
+void OutputDispatcher::cancel_timer(Entry& e)
+{
+    if (not e.has_timer) return;
+    _timers.erase(e.timer);
+    e.has_timer = false;
+}
+
+// Put the shell on the ready queue, and make sure that some thread
+// will pick it up. Caller must hold the lock.
+void OutputDispatcher::enqueue(GenericShell* sh, Entry& e)
+{
+    e.state = QUEUED;
+    _ready.push_back(sh);
+    _max_ready = std::max(_max_ready, _ready.size());
+
+    if (_ready.size() <= _nidle)
+    {
+        _work_cv.notify_one();
+        return;
+    }
+    if (_stop) return;
+
+    reap();
+    std::thread thr(&OutputDispatcher::worker, this);
+    std::thread::id tid = thr.get_id();
+    _threads.emplace(tid, std::move(thr));
+}
+
+void OutputDispatcher::add(GenericShell* sh)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    Entry& e = _shells[sh];
+    e.state = IDLE;
+    e.woken = false;
+    e.idle = min_idle;
+    e.has_timer = false;
+
+    // Poll once right away, the way a fresh shell always has.
+    enqueue(sh, e);
+}
+
+void OutputDispatcher::remove(GenericShell* sh)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    auto it = _shells.find(sh);
+    if (_shells.end() == it) return;
+
+    Entry& e = it->second;
+    _done_cv.wait(lock, [&e] { return RUNNING != e.state; });
+
+    if (QUEUED == e.state)
+        _ready.erase(std::find(_ready.begin(), _ready.end(), sh));
+    cancel_timer(e);
+    _shells.erase(it);
+}
+
+void OutputDispatcher::wake(GenericShell* sh)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    auto it = _shells.find(sh);
+    if (_shells.end() == it) return;
+
+    Entry& e = it->second;
+    e.idle = min_idle;
+    if (RUNNING == e.state)
+        e.woken = true;
+    else if (IDLE == e.state)
+    {
+        cancel_timer(e);
+        enqueue(sh, e);
+    }
+}
+
+void OutputDispatcher::worker(void)
+{
+    prctl(PR_SET_NAME, "cogserv:output", 0, 0, 0);
+
+    std::unique_lock<std::mutex> lock(_mtx);
+    while (true)
+    {
+        // Idle shells whose re-poll time has come go to the
+        // back of the ready queue.
+        time_point now = std::chrono::steady_clock::now();
+        while (not _timers.empty() and _timers.begin()->first <= now)
+        {
+            GenericShell* sh = _timers.begin()->second;
+            Entry& e = _shells.at(sh);
+            _timers.erase(_timers.begin());
+            e.has_timer = false;
+            e.state = QUEUED;
+            _ready.push_back(sh);
+        }
+
+        if (_ready.empty())
+        {
+            if (_stop or _max_idle <= _nidle) break;
+
+            auto have_work = [this] { return _stop or not _ready.empty(); };
+            _nidle++;
+            bool expired = false;
+            if (_timers.empty())
+                expired = not _work_cv.wait_for(lock,
+                    std::chrono::seconds(_idle_secs), have_work);
+            else
+            {
+                // Copy the deadline; the timer may be taken meanwhile.
+                time_point next = _timers.begin()->first;
+                _work_cv.wait_until(lock, next, have_work);
+            }
+            _nidle--;
+
+            // Nothing to do, and nothing scheduled; retire.
+            if (expired and _timers.empty()) break;
+            continue;
+        }
+
+        GenericShell* sh = _ready.front();
+        _ready.pop_front();
+        Entry& e = _shells.at(sh);
+        e.state = RUNNING;
+        e.woken = false;
+        _nbusy++;
+        _ndispatched++;
+        lock.unlock();
+
+        // This blocks for as long as the shell is evaluating.
+        bool sent = sh->dispatch_output();
+        bool threads = sh->threads_left();
+
+        // Idle shells stay off the queue until they are woken, unless
+        // they left threads running.
+        lock.lock();
+        _nbusy--;
+        if (e.woken)
+            enqueue(sh, e);
+        else if (not threads)
+            e.state = IDLE;
+        else
+        {
+            e.state = IDLE;
+            e.idle = sent ? min_idle : std::min(2 * e.idle, max_idle);
+            time_point when = std::chrono::steady_clock::now() + e.idle;
+            bool earliest = _timers.empty() or when < _timers.begin()->first;
+            e.timer = _timers.emplace(when, sh);
+            e.has_timer = true;
+            if (earliest) _work_cv.notify_one();
+        }
+        _done_cv.notify_all();
+    }
+
+    // Exiting. Someone else will join us.
+    _dead.push_back(std::this_thread::get_id());
+    _done_cv.notify_all();
+}
+
+void OutputDispatcher::stop(void)
+{
+    std::unique_lock<std::mutex> lock(_mtx);
+    _stop = true;
+    _work_cv.notify_all();
+
+    logger().debug("[OutputDispatcher] Waiting for %zu threads",
+                   _threads.size());
+    _done_cv.wait(lock, [this] { return _dead.size() == _threads.size(); });
+    reap();
+}
+
+std::string OutputDispatcher::display_stats(void)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    char buff[180];
+    snprintf(buff, sizeof(buff),
+        "out-dispatch: threads: %zu  busy: %zu  shells: %zu  ready: %zu  max-ready: %zu  polls: %zu\n",
+        _threads.size() - _dead.size(), _nbusy, _shells.size(),
+        _ready.size(), _max_ready, _ndispatched);
+    return buff;
+}
@@ -0,0 +1,111 @@
+/*
+ * opencog/network/OutputDispatcher.h
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifndef _OPENCOG_OUTPUT_DISPATCHER_H
+#define _OPENCOG_OUTPUT_DISPATCHER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace opencog
+{
+/** \addtogroup grp_server
+ *  @{
+ */
+
+class GenericShell;
+
+/**
+ * Forwards evaluator output to the sockets, for all shells.
+ *
+ * Shells used to have a private polling thread each, which spent
+ * most of its life asleep. Here, instead, a shell is queued up when
+ * its eval thread signals that there is something to do (an
+ * evaluation started or ended); a dispatcher thread then takes it
+ * and forwards output until the evaluation finishes.
+ *
+ * While an evaluation runs, the evaluator blocks the thread that
+ * polls it; thus the pool grows on demand, with one thread for each
+ * shell that is busy evaluating, plus a few idle ones. Shells that
+ * are idle are not polled, until they are woken again; the exception
+ * are shells whose last evaluation left threads running, as those
+ * might print at any time. The evaluators have no way of saying that
+ * they have output, so these are re-polled on a timer, with backoff,
+ * until the threads are gone.
+ */
+class OutputDispatcher
+{
+private:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    enum State { IDLE, QUEUED, RUNNING };
+    struct Entry
+    {
+        State state;
+        bool woken;          // Woken while running; run it again.
+        std::chrono::milliseconds idle;
+        std::multimap<time_point, GenericShell*>::iterator timer;
+        bool has_timer;
+    };
+
+    std::mutex _mtx;
+    std::condition_variable _work_cv;
+    std::condition_variable _done_cv;
+
+    std::unordered_map<GenericShell*, Entry> _shells;
+    std::deque<GenericShell*> _ready;
+    std::multimap<time_point, GenericShell*> _timers;
+
+    std::map<std::thread::id, std::thread> _threads;
+    std::vector<std::thread::id> _dead;
+    size_t _nidle;
+    size_t _nbusy;
+    size_t _max_idle;
+    unsigned int _idle_secs;
+    bool _stop;
+
+    // Stats
+    size_t _ndispatched;
+    size_t _max_ready;
+
+    void worker(void);
+    void reap(void);
+    void enqueue(GenericShell*, Entry&);
+    void cancel_timer(Entry&);
+
+public:
+    OutputDispatcher(size_t max_idle = 4, unsigned int idle_secs = 30);
+    ~OutputDispatcher();
+
+    /// Start forwarding output for the shell.
+    void add(GenericShell*);
+
+    /// Stop forwarding output for the shell. Upon return, no
+    /// dispatcher thread is touching the shell.
+    void remove(GenericShell*);
+
+    /// The shell has (or will soon have) output; poll it now.
+    void wake(GenericShell*);
+
+    /// Join all threads. Shells should have been removed beforehand.
+    void stop(void);
+
+    /// One line of stats, newline-terminated.
+    std::string display_stats(void);
+};
+
+/** @}*/
+}  // namespace
+
+#endif // _OPENCOG_OUTPUT_DISPATCHER_H
@@ -0,0 +1,296 @@
+/*
+ * opencog/network/Reactor.cc
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <unistd.h>
+
+#include <opencog/util/exceptions.h>
+#include <opencog/util/Logger.h>
+#include <opencog/network/HandlerPool.h>
+#include <opencog/network/Reactor.h>
+#include <opencog/network/ServerSocket.h>
+
+using namespace opencog;
+
+// The epoll events of interest, given the state of a socket.
+static uint32_t interest(unsigned int state)
+{
+    // Disarmed, but for a single hangup or error, which can't be
+    // masked; the reactor thread will skip over that.
+    if (state & Reactor::BUSY) return EPOLLONESHOT;
+
+    // Writable, which is right away, so that the reactor thread
+    // gets to close it.
+    if (state & Reactor::DONE) return EPOLLOUT;
+
+    // Hangups are still reported while paused.
+    if (state & Reactor::PAUSED) return 0;
+
+    return EPOLLIN | EPOLLRDHUP;
+}
+
+Reactor::Reactor(unsigned int nthreads, HandlerPool* pool) :
+    _running(true), _next(0), _pool(pool), _closing(0), _offloaded(0)
+{
+    if (0 == nthreads) nthreads = 1;
+
+    _stopfd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (_stopfd < 0)
+        throw RuntimeException(TRACE_INFO,
+            "Reactor: unable to create eventfd: %s", strerror(errno));
+
+    for (unsigned int i=0; i<nthreads; i++)
+    {
+        int epfd = epoll_create1(EPOLL_CLOEXEC);
+        if (epfd < 0)
+            throw RuntimeException(TRACE_INFO,
+                "Reactor: unable to create epoll: %s", strerror(errno));
+
+        // The stop fd is shared by all threads; since it is never
+        // read, it stays readable, and wakes up every thread.
+        struct epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = nullptr;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, _stopfd, &ev);
+        _epfds.push_back(epfd);
+    }
+
+    for (unsigned int i=0; i<nthreads; i++)
+        _threads.emplace_back(&Reactor::loop, this, _epfds[i]);
+}
+
+Reactor::~Reactor()
+{
+    stop();
+    for (int epfd : _epfds) close(epfd);
+    close(_stopfd);
+}
+
+void Reactor::add(ServerSocket* ss)
+{
+    ss->_reactor = this;
+    int fd = ss->_socket->native_handle();
+    ss->_tid = -fd;
+
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _socks.emplace(ss, 0);
+    }
+
+    // Telnet sockets say hello here; this may send a prompt.
+    ss->start_connection();
+    ss->_status = ServerSocket::IWAIT;
+
+    // A pause_input() may already have come in, from a shell that
+    // started up in start_connection(). Register under the lock, so
+    // that the pause is honoured, and so that _epfd is published only
+    // once the socket is actually in the epoll set.
+    int epfd = _epfds[_next++ % _epfds.size()];
+    int err = 0;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = _socks.find(ss);
+        if (_socks.end() == it) return;
+
+        struct epoll_event ev;
+        ev.events = interest(it->second);
+        ev.data.ptr = ss;
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev))
+            err = errno;
+        else
+            ss->_epfd = epfd;
+    }
+    if (err)
+    {
+        logger().warn("Reactor: unable to add socket: %s", strerror(err));
+        close_sock(-1, ss, false);
+    }
+}
+
+void Reactor::pause_input(ServerSocket* ss, bool pause)
+{
+    // Under the lock, so that the socket can't be removed from the
+    // epoll set while we modify it.
+    std::lock_guard<std::mutex> lock(_mtx);
+    auto it = _socks.find(ss);
+    if (_socks.end() == it) return;
+    if (pause)
+        it->second |= PAUSED;
+    else
+        it->second &= ~PAUSED;
+
+    // Not in the epoll set yet; add() will look at the flag. If it
+    // is on a pool thread, it will be re-armed when it comes back.
+    if (ss->_epfd < 0 or (it->second & BUSY)) return;
+
+    struct epoll_event ev;
+    ev.events = interest(it->second);
+    ev.data.ptr = ss;
+    if (epoll_ctl(ss->_epfd, EPOLL_CTL_MOD, ss->_socket->native_handle(), &ev))
+        logger().warn("Reactor: unable to %s socket: %s",
+            pause ? "pause" : "resume", strerror(errno));
+}
+
+void Reactor::close_sock(int epfd, ServerSocket* ss, bool async)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (0 == _socks.erase(ss)) return;
+        if (async) _closing++;
+    }
+    if (0 <= epfd)
+        epoll_ctl(epfd, EPOLL_CTL_DEL, ss->_socket->native_handle(), nullptr);
+
+    // finish_connection() deletes the socket.
+    if (not async)
+    {
+        ss->finish_connection();
+        return;
+    }
+
+    _pool->run([this, ss]() {
+        prctl(PR_SET_NAME, "cogserv:rclose", 0, 0, 0);
+        ss->finish_connection();
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (0 == --_closing) _closing_cv.notify_all();
+    });
+}
+
+/// Read from the socket on a pool thread, instead of on the reactor
+/// thread, because its OnLine() may block. The socket is disarmed
+/// until it is done, so that only one thread reads from it at a time,
+/// and the input is handled in order.
+void Reactor::offload(int epfd, ServerSocket* ss)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _socks[ss] |= BUSY;
+        _offloaded++;
+
+        struct epoll_event ev;
+        ev.events = interest(BUSY);
+        ev.data.ptr = ss;
+        epoll_ctl(epfd, EPOLL_CTL_MOD, ss->_socket->native_handle(), &ev);
+    }
+
+    _pool->run([this, epfd, ss]() {
+        bool open = ss->on_readable();
+
+        // Only the reactor thread closes sockets. If this one is
+        // done for, let that thread know.
+        std::lock_guard<std::mutex> lock(_mtx);
+        unsigned int& state = _socks[ss];
+        state &= ~BUSY;
+        if (not open) state |= DONE;
+        if (_running)
+        {
+            struct epoll_event ev;
+            ev.events = interest(state);
+            ev.data.ptr = ss;
+            epoll_ctl(epfd, EPOLL_CTL_MOD, ss->_socket->native_handle(), &ev);
+        }
+        if (0 == --_offloaded) _closing_cv.notify_all();
+    });
+}
+
+void Reactor::loop(int epfd)
+{
+    prctl(PR_SET_NAME, "cogserv:reactor", 0, 0, 0);
+
+    static constexpr int MAXEV = 64;
+    struct epoll_event evs[MAXEV];
+    while (_running)
+    {
+        int nev = epoll_wait(epfd, evs, MAXEV, -1);
+        if (nev < 0)
+        {
+            if (EINTR == errno) continue;
+            logger().error("Reactor: epoll_wait failed: %s", strerror(errno));
+            break;
+        }
+
+        for (int i=0; i<nev; i++)
+        {
+            ServerSocket* ss = (ServerSocket*) evs[i].data.ptr;
+            if (nullptr == ss) return;
+
+            // Sockets are deleted only by this thread, so `ss` is
+            // still good; but it may be out on a pool thread, or
+            // back from one, and done for.
+            unsigned int state;
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                auto it = _socks.find(ss);
+                if (_socks.end() == it) continue;
+                state = it->second;
+            }
+            if (state & BUSY) continue;
+            if (state & DONE)
+            {
+                close_sock(epfd, ss, true);
+                continue;
+            }
+
+            if (ss->handler_may_block())
+            {
+                offload(epfd, ss);
+                continue;
+            }
+
+            // Even on hangup, there may be data still buffered in the
+            // kernel; on_readable() returns false only after EOF.
+            if (not ss->on_readable())
+                close_sock(epfd, ss, true);
+        }
+    }
+}
+
+void Reactor::stop(void)
+{
+    if (not _running.exchange(false)) return;
+
+    uint64_t one = 1;
+    if (write(_stopfd, &one, sizeof(one)) < 0)
+        logger().warn("Reactor: unable to signal stop: %s", strerror(errno));
+
+    for (std::thread& t : _threads)
+        if (t.joinable()) t.join();
+
+    // Sockets that are out on pool threads are not re-armed, once
+    // stopped; wait for them to come back.
+    {
+        std::unique_lock<std::mutex> lock(_mtx);
+        _closing_cv.wait(lock, [this] { return 0 == _offloaded; });
+    }
+
+    // Whatever is left over gets closed here.
+    while (true)
+    {
+        ServerSocket* ss;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_socks.empty()) break;
+            ss = _socks.begin()->first;
+        }
+        close_sock(-1, ss, false);
+    }
+
+    // Sockets that were closed earlier may still be tearing down in
+    // the pool; they use our lock when they are done.
+    std::unique_lock<std::mutex> lock(_mtx);
+    _closing_cv.wait(lock, [this] { return 0 == _closing; });
+}
+
+size_t Reactor::num_sockets(void)
+{
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _socks.size();
+}
@@ -0,0 +1,112 @@
+/*
+ * opencog/network/Reactor.h
+ *
+ * Copyright (C) 2026 OpenCog Foundation
+ * SPDX-License-Identifier: AGPL-3.0-or-later
+ */
+
+#ifndef _OPENCOG_REACTOR_H
+#define _OPENCOG_REACTOR_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <map>
+#include <thread>
+#include <vector>
+
+namespace opencog
+{
+/** \addtogroup grp_server
+ *  @{
+ */
+
+class HandlerPool;
+class ServerSocket;
+
+/**
+ * The Reactor is an alternative to the thread-per-connection model
+ * of ServerSocket::handle_connection(). A small, fixed number of
+ * threads each run an epoll loop, and perform all of the socket reads
+ * for all of the connections assigned to them. When a socket becomes
+ * readable, whatever data is available is read without blocking, and
+ * every complete line (or HTTP body, or websocket frame) is passed to
+ * the usual ServerSocket::OnLine() callback, in the reactor thread.
+ *
+ * This is intended for servers with many thousands of mostly-idle
+ * connections, where having one thread (and one stack) per connection
+ * is wasteful. OnLine() runs in the reactor thread, and so it must
+ * not block for long; this is the case for the shell-based sockets,
+ * which just enqueue the line for evaluation. Sockets whose OnLine()
+ * might block, e.g. to evaluate an HTTP request, or to enter a shell,
+ * say so with ServerSocket::handler_may_block(). The reactor does not
+ * read those itself; it hands them to a HandlerPool thread, one read
+ * at a time, so that the other sockets are not held up. Writes remain
+ * blocking.
+ *
+ * Sockets are assigned round-robin to the reactor threads, and stay
+ * with that thread for their lifetime. Epoll is level-triggered, so
+ * nothing is lost if a socket is not drained in one pass.
+ *
+ * Closed sockets are torn down on a HandlerPool thread, because the
+ * ConsoleSocket dtor waits for any evaluation that is still running;
+ * the reactor thread must not stall on that. stop() waits for all
+ * of these to finish.
+ */
+class Reactor
+{
+private:
+    std::atomic_bool _running;
+    int _stopfd;            // eventfd, used to wake up all threads.
+    std::vector<int> _epfds;
+    std::vector<std::thread> _threads;
+    std::atomic_size_t _next;
+
+    // All sockets currently owned by this reactor, and their state.
+    std::mutex _mtx;
+    std::map<ServerSocket*, unsigned int> _socks;
+
+    // Number of sockets being torn down, off the reactor threads.
+    HandlerPool* _pool;
+    size_t _closing;
+    std::condition_variable _closing_cv;
+
+    // Number of sockets being read on pool threads.
+    size_t _offloaded;
+
+    void loop(int);
+    void close_sock(int, ServerSocket*, bool);
+    void offload(int, ServerSocket*);
+
+public:
+    // Socket state bits.
+    static constexpr unsigned int PAUSED = 1;   // Input is paused
+    static constexpr unsigned int BUSY = 2;     // Out on a pool thread
+    static constexpr unsigned int DONE = 4;     // To be closed
+
+    /// The pool is used for work that might block; it must outlive
+    /// the reactor, or at least, stop().
+    Reactor(unsigned int nthreads, HandlerPool*);
+    ~Reactor();
+
+    /// Hand a connected socket to the reactor. The reactor takes
+    /// ownership: the socket will be deleted when the remote end
+    /// closes the connection, or when the reactor is stopped.
+    void add(ServerSocket*);
+
+    /// Stop (or resume) polling the socket for input. Hangups are
+    /// still reported while paused.
+    void pause_input(ServerSocket*, bool);
+
+    /// Stop all reactor threads, and close all remaining sockets.
+    /// Returns once every socket has been torn down.
+    void stop(void);
+
+    size_t num_threads(void) const { return _threads.size(); }
+    size_t num_sockets(void);
+};
+
+/** @}*/
+}  // namespace
+
+#endif // _OPENCOG_REACTOR_H
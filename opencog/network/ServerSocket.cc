@@ -7,16 +7,25 @@
  * SPDX-License-Identifier: AGPL-3.0-or-later
  */
 
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 #include <time.h>
+#include <algorithm>
 #include <mutex>
 #include <set>
 
 #include <opencog/util/exceptions.h>
 #include <opencog/util/Logger.h>
 #include <opencog/util/oc_assert.h>
+#include <opencog/network/Compress.h>
+#include <opencog/network/Reactor.h>
 #include <opencog/network/ServerSocket.h>
 #include <opencog/network/SocketManager.h>
 
@@ -29,6 +38,7 @@ char ServerSocket::START[6] = "start";
 char ServerSocket::BLOCK[6] = "block";
 char ServerSocket::IWAIT[6] = "iwait";
 char ServerSocket::BAR[6]   = "-bar-";
+char ServerSocket::STALL[6] = "stall";
 char ServerSocket::DTOR[6]  = "dtor ";
 char ServerSocket::QUING[6] = "quing";
 char ServerSocket::CLOSE[6] = "close";
@@ -50,16 +60,15 @@ std::string ServerSocket::connection_stats(void)
 
     // Most recent activity
     char abuff[20];
-    gmtime_r(&_last_activity, &tm);
+    time_t last = _last_activity.load(std::memory_order_relaxed);
+    gmtime_r(&last, &tm);
     strftime(abuff, 20, "%d %b %H:%M:%S", &tm);
 
     // Thread ID as shown by `ps -eLf`
     char bf[132];
     snprintf(bf, 132, "%s %8d %s %5zd %s %c",
-        sbuff, _tid, _status, _line_count, abuff,
-        _do_frame_io?'W':
-            (_is_http_socket?'H':
-                (_is_mcp_socket?'M':'T')));
+        sbuff, _tid, _status.load(std::memory_order_relaxed),
+        _line_count.load(std::memory_order_relaxed), abuff, kind());
 
     return bf;
 }
@@ -77,13 +86,33 @@ static std::mutex _asio_crash;
 ServerSocket::ServerSocket(SocketManager* mgr) :
     _socket(nullptr),
     _socket_manager(mgr),
-    _got_first_line(false),
+    _has_slot(false),
+    _reactor(nullptr),
+    _epfd(-1),
+    _pool(nullptr),
+    _input_throttled(false),
+    _rx_start(0),
+    _rx_end(0),
+    _rx_scan(0),
+    _rx_iac(false),
+    _batch_bytes(0),
+    _batch_usec(0),
+    _corked(false),
     _got_http_header(false),
+    _in_http_body(false),
+    _chunked(false),
     _do_frame_io(false),
+    _ws_fragmented(false),
+    _ws_msg_compressed(false),
+    _ws_deflater(nullptr),
+    _ws_inflater(nullptr),
     _is_http_socket(false),
     _got_websock_header(false),
     _is_mcp_socket(false),
+    _ws_binary(false),
     _keep_alive(false),
+    _http_version(11),
+    _accept_gzip(false),
     _in_barrier(false),
     _content_length(0),
     _host_header("")
@@ -92,12 +121,10 @@ ServerSocket::ServerSocket(SocketManager* mgr) :
     _last_activity = _start_time;
     _tid = 0;
     _pth = 0;
-    _status = BLOCK;
     _line_count = 0;
 
-    // Block here, if there are too many concurrently-open sockets.
-    _socket_manager->wait_available_slot();
-    _status = START;
+    // Remain blocked until the SocketManager admits this socket.
+    _status = BLOCK;
 }
 
 ServerSocket::~ServerSocket()
@@ -105,6 +132,12 @@ ServerSocket::~ServerSocket()
     _status = DTOR;
     logger().debug("ServerSocket::~ServerSocket()");
 
+    // Push out anything still sitting in the output batch. A flush
+    // may still be scheduled even if batching was turned off since.
+    _socket_manager->cancel_flush(this);
+    if (not _socket_manager->is_network_gone())
+        flush_output();
+
     Exit();
 
     // Unregister from socket manager
@@ -112,7 +145,8 @@ ServerSocket::~ServerSocket()
 
     // If anyone is waiting for a socket, let them know that
     // we've freed one up.
-    _socket_manager->release_slot();
+    if (_has_slot)
+        _socket_manager->release_slot();
 
     // An attempt to delete an asio socket, after being stopped with
     // `asio::io_service::stop()` will result in a crash, deep
@@ -122,7 +156,13 @@ ServerSocket::~ServerSocket()
 
     if (not _socket_manager->is_network_gone())
         delete _socket;
+
     _socket = nullptr;
+
+#ifdef HAVE_ZLIB
+    delete _ws_deflater;
+    delete _ws_inflater;
+#endif
 }
 
 // ==================================================================
@@ -143,7 +183,10 @@ void ServerSocket::Send(const std::string& cmd)
 
     if (not _do_frame_io)
     {
-        Send(asio::const_buffer(cmd.c_str(), cmdsize));
+        if (_batch_bytes)
+            send_batched(cmd);
+        else
+            Send(asio::const_buffer(cmd.c_str(), cmdsize));
         return;
     }
 
@@ -151,13 +194,146 @@ void ServerSocket::Send(const std::string& cmd)
     send_websocket(cmd);
 }
 
+void ServerSocket::SendBinary(const std::string& buf)
+{
+    if (buf.empty()) return;
+
+    if (not _do_frame_io)
+    {
+        if (_batch_bytes)
+            send_batched(buf);
+        else
+            Send(asio::const_buffer(buf.c_str(), buf.size()));
+        return;
+    }
+
+    send_websocket(buf, true);
+}
+
+// ==================================================================
+// Output batching. Pipelined clients that send many short commands
+// get many short replies; sending each in its own syscall results in
+// one tiny TCP segment per reply. When batching is enabled, replies
+// are accumulated, and sent when the batch is large enough, when the
+// oldest byte in it is older than the deadline, or when the shell
+// goes idle (see GenericShell::poll_and_send()). Interactive users
+// see no delay, since an idle shell always flushes.
+
+/// Enable output batching; zero bytes disables it. This may be
+/// called from any thread, while replies are being sent.
+void ServerSocket::set_output_batching(size_t bytes, unsigned int usec)
+{
+    std::lock_guard<std::mutex> lock(_out_mtx);
+    _batch_usec.store(usec, std::memory_order_relaxed);
+    _batch_bytes.store(bytes, std::memory_order_relaxed);
+    if (0 == bytes) flush_locked();
+}
+
+void ServerSocket::send_batched(const std::string& cmd)
+{
+    bool first = false;
+    unsigned int usec;
+    {
+        std::lock_guard<std::mutex> lock(_out_mtx);
+        first = _out_buf.empty();
+        _out_buf += cmd;
+
+        // A full batch goes out right away; so does everything, if
+        // batching was turned off in the meantime. Tell the kernel
+        // that more is coming, so that the tail can be packed with
+        // what follows; the flush below uncorks it, if nothing does.
+        size_t bytes = _batch_bytes.load(std::memory_order_relaxed);
+        usec = _batch_usec.load(std::memory_order_relaxed);
+        if (bytes <= _out_buf.size())
+        {
+            write_out(_out_buf.data(), _out_buf.size(), 0 < bytes);
+            _out_buf.clear();
+            if (0 == bytes) return;
+            first = not _corked;
+            _corked = true;
+        }
+    }
+
+    // The first bytes of a new batch start the clock.
+    if (first)
+        _socket_manager->schedule_flush(this, usec);
+}
+
+/// Send everything that is batched up.
+void ServerSocket::flush_output(void)
+{
+    std::lock_guard<std::mutex> lock(_out_mtx);
+    flush_locked();
+}
+
+/// Caller must hold _out_mtx.
+void ServerSocket::flush_locked(void)
+{
+    if (not _out_buf.empty())
+    {
+        write_out(_out_buf.data(), _out_buf.size(), false);
+        _out_buf.clear();
+        _corked = false;
+        return;
+    }
+
+    // The last full batch went out with MSG_MORE, and nothing has
+    // followed it. Setting TCP_NODELAY pushes out what the kernel
+    // is holding back.
+    if (_corked)
+    {
+        int one = 1;
+        setsockopt(_socket->native_handle(), IPPROTO_TCP, TCP_NODELAY,
+                   &one, sizeof(one));
+        _corked = false;
+    }
+}
+
+/// Raw blocking send, with MSG_MORE if `more` is set.
+void ServerSocket::write_out(const char* buf, size_t len, bool more)
+{
+    int fd = _socket->native_handle();
+    int flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+    while (0 < len)
+    {
+        ssize_t n = ::send(fd, buf, len, flags);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+
+            // Same policy as Send(): don't log a closed remote end.
+            if (ENOTCONN != errno and EPIPE != errno and
+                EBADF != errno and ECONNRESET != errno)
+                logger().warn("ServerSocket::write_out(): %s", strerror(errno));
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
 void ServerSocket::Send(const asio::const_buffer& buf)
+{
+    Send({buf});
+}
+
+// Gathering write: all of the buffers go out in one writev(), so
+// that e.g. a header and its payload don't become separate packets
+// (TCP_NODELAY is set), and the payload need not be copied just to
+// prepend the header.
+void ServerSocket::Send(std::initializer_list<asio::const_buffer> bufs)
 {
     OC_ASSERT(_socket, "Use of socket after it's been closed!\n");
 
+    // Keep the byte stream in order: anything batched goes first, and
+    // no other writer may slip in between, or into the middle.
     std::error_code error;
-    asio::write(*_socket, buf,
-                       asio::transfer_all(), error);
+    {
+        std::lock_guard<std::mutex> lock(_out_mtx);
+        flush_locked();
+        asio::write(*_socket, bufs,
+                           asio::transfer_all(), error);
+    }
 
     // The most likely cause of an error is that the remote side has
     // closed the socket, even though we still had stuff to send.
@@ -174,6 +350,52 @@ void ServerSocket::Send(const asio::const_buffer& buf)
              error.message().c_str(), pthread_self());
 }
 
+void ServerSocket::SendFile(const std::string& header,
+                            int fd, off_t offset, size_t len)
+{
+    OC_ASSERT(_socket, "Use of socket after it's been closed!\n");
+
+    // Keep the byte stream in order. The header is corked onto the
+    // start of the file data.
+    std::lock_guard<std::mutex> lock(_out_mtx);
+    if (not _out_buf.empty())
+    {
+        write_out(_out_buf.data(), _out_buf.size(), true);
+        _out_buf.clear();
+    }
+    write_out(header.data(), header.size(), 0 < len);
+
+    // If less than the promised Content-Length goes out, the client
+    // would read the next reply as the rest of this one. So the
+    // connection is closed once this request is done.
+    int sock = _socket->native_handle();
+    while (0 < len)
+    {
+        ssize_t n = ::sendfile(sock, fd, &offset, len);
+        if (n < 0)
+        {
+            if (EINTR == errno) continue;
+
+            // Same policy as Send(): don't log a closed remote end.
+            if (ENOTCONN != errno and EPIPE != errno and
+                EBADF != errno and ECONNRESET != errno)
+                logger().warn("ServerSocket::SendFile(): %s", strerror(errno));
+            _keep_alive = false;
+            return;
+        }
+
+        // The file got shorter, after the header was made.
+        if (0 == n)
+        {
+            logger().warn("ServerSocket::SendFile(): file shrank; "
+                          "%zu bytes short", len);
+            _keep_alive = false;
+            return;
+        }
+        len -= n;
+    }
+}
+
 // This is called in a different thread than the thread that is running
 // the handle_connection() method. It's purpose in life is to terminate
 // the connection -- it does so by closing the socket. Sometime later,
@@ -214,7 +436,14 @@ void ServerSocket::Exit()
         //
         // The long-term solution is to rewrite this code to not use
         // asio. But that is just a bit more than a weekend project.
-        if (not _socket_manager->is_network_gone())
+        //
+        // Sockets that belong to a Reactor are never closed here:
+        // the reactor must first see the shutdown, and remove the
+        // file descriptor from its epoll set. Closing it out from
+        // under the reactor would allow the fd number to be recycled
+        // by the next accept, while it is still registered. The close
+        // happens later, in the dtor.
+        if (not _socket_manager->is_network_gone() and nullptr == _reactor)
             _socket->close();
     }
     catch (const std::system_error& e)
@@ -226,84 +455,505 @@ void ServerSocket::Exit()
         }
     }
     _status = DOWN;
+
+    // Don't leave the reader waiting for a queue that no one
+    // will be draining.
+    throttle_input(false);
 }
 
 // ==================================================================
 
+void ServerSocket::throttle_input(bool stop)
+{
+    {
+        std::lock_guard<std::mutex> lock(_throttle_mtx);
+        if (stop == _input_throttled) return;
+        _input_throttled = stop;
+    }
+
+    // The reactor stops polling the socket for input; the kernel
+    // receive buffer then fills up, and the client's sends stall.
+    if (_reactor)
+    {
+        _status = stop ? STALL : IWAIT;
+        _reactor->pause_input(this, stop);
+    }
+    else if (not stop)
+        _throttle_cv.notify_all();
+}
+
+/// Called by handle_connection() before each read.
+void ServerSocket::wait_unthrottled(void)
+{
+    std::unique_lock<std::mutex> lock(_throttle_mtx);
+    if (not _input_throttled) return;
+    _status = STALL;
+    _throttle_cv.wait(lock, [this] { return not _input_throttled; });
+}
+
+// ==================================================================
+
+/// Default for users that only handle std::string lines. The string
+/// is reused from line to line, so that, once it has grown to the
+/// typical line length, this does not allocate.
+void ServerSocket::OnLine(std::string_view line)
+{
+    _line_buf.assign(line.data(), line.size());
+    OnLine(_line_buf);
+}
+
+// ==================================================================
+
+/// The server is overloaded, and this connection will not be served.
+/// Say so, in whatever protocol the client is expecting, and close.
+void ServerSocket::reject(void)
+{
+    _status = CLOSE;
+    logger().info("ServerSocket: server busy, rejecting connection");
+
+    if (_is_mcp_socket)
+        Send("{\"jsonrpc\":\"2.0\",\"id\":null,\"error\":"
+             "{\"code\":-32000,\"message\":\"Server busy; "
+             "too many open connections\"}}\n");
+    else if (_is_http_socket)
+        Send("HTTP/1.1 503 Service Unavailable\r\n"
+             "Server: CogServer\r\n"
+             "Retry-After: 5\r\n"
+             "Content-Type: text/plain\r\n"
+             "Content-Length: 41\r\n"
+             "Connection: close\r\n"
+             "\r\n"
+             "Server busy; too many open connections.\r\n");
+    else
+        Send("Error: server busy; too many open connections. "
+             "Try again later.\n");
+
+    // Discard whatever the client has already sent. Closing a socket
+    // with unread data results in a reset, which can cause the client
+    // to lose the reply sent above.
+    int fd = _socket->native_handle();
+    shutdown(fd, SHUT_WR);
+    char junk[4096];
+    while (0 < recv(fd, junk, sizeof(junk), MSG_DONTWAIT)) {}
+
+    delete this;
+}
+
 void ServerSocket::set_connection(asio::ip::tcp::socket* sock)
 {
     if (_socket) delete _socket;
     _socket = sock;
 
+    _socket_manager->set_keepalive_opts(_socket->native_handle());
     _socket_manager->add_sock(this);
 }
 
 // ==================================================================
 
-typedef asio::buffers_iterator<
-    asio::streambuf::const_buffers_type> bitter;
-
 // See RFC 854
 #define IAC 0xff  // Telnet Interpret As Command
 
+// Return the offset of the first newline, ctrl-D or telnet IAC byte
+// in the buffer, or `len` if there is none. This is the hot loop for
+// bulk uploads of many short lines, and so it is vectorized. SSE2 is
+// always available on x86_64; AVX2 is used if the CPU has it.
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+__attribute__((target("avx2")))
+static size_t find_special_avx2(const char* buf, size_t len)
+{
+    const __m256i nl = _mm256_set1_epi8('\n');
+    const __m256i eot = _mm256_set1_epi8(0x04);
+    const __m256i iac = _mm256_set1_epi8((char) IAC);
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i*) (buf + i));
+        __m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, nl),
+                    _mm256_or_si256(_mm256_cmpeq_epi8(v, eot),
+                                    _mm256_cmpeq_epi8(v, iac)));
+        unsigned int bits = _mm256_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    for (; i < len; i++)
+    {
+        unsigned char c = buf[i];
+        if ('\n' == c or 0x04 == c or IAC == c) return i;
+    }
+    return len;
+}
+
+static size_t find_special_sse2(const char* buf, size_t len)
+{
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i eot = _mm_set1_epi8(0x04);
+    const __m128i iac = _mm_set1_epi8((char) IAC);
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i*) (buf + i));
+        __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, nl),
+                    _mm_or_si128(_mm_cmpeq_epi8(v, eot),
+                                 _mm_cmpeq_epi8(v, iac)));
+        unsigned int bits = _mm_movemask_epi8(m);
+        if (bits) return i + __builtin_ctz(bits);
+    }
+    for (; i < len; i++)
+    {
+        unsigned char c = buf[i];
+        if ('\n' == c or 0x04 == c or IAC == c) return i;
+    }
+    return len;
+}
+
+static size_t find_special(const char* buf, size_t len)
+{
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    if (have_avx2) return find_special_avx2(buf, len);
+    return find_special_sse2(buf, len);
+}
+
+#else // __x86_64__
+
+static size_t find_special(const char* buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+    {
+        unsigned char c = buf[i];
+        if ('\n' == c or 0x04 == c or IAC == c) return i;
+    }
+    return len;
+}
+#endif // __x86_64__
+
 // Goal: if the user types in a ctrl-C or a ctrl-D, we want to
 // react immediately to this. A ctrl-D is just the ascii char 0x4
 // while the ctrl-C is wrapped in a telnet "interpret as command"
 // IAC byte sequence.  Basically, we want to forward all IAC
 // sequences immediately, as well as the ctrl-D.
 //
-std::pair<bitter, bool>
-match_eol_or_escape(bitter begin, bitter end)
+// Returns the offset just past the matching char, or zero if there
+// is no match. The `telnet_mode` flag carries state across calls,
+// so that the scan can be resumed where it left off.
+static size_t match_eol_or_escape(const char* buf, size_t len,
+                                  bool& telnet_mode)
 {
-    bool telnet_mode = false;
-    bitter i = begin;
-    while (i != end)
+    size_t i = 0;
+    if (not telnet_mode)
     {
-        unsigned char c = *i++;
+        i = find_special(buf, len);
+        if (len == i) return 0;
+        if (IAC != (unsigned char) buf[i]) return i+1;
+    }
+
+    // Rare: a telnet command sequence. Go byte by byte.
+    for (; i < len; i++)
+    {
+        unsigned char c = buf[i];
         if (IAC == c) telnet_mode = true;
         if (('\n' == c) ||
             (0x04 == c) || // ASCII EOT End of Transmission (ctrl-D)
             (telnet_mode && (c <= 0xf0)))
         {
-            return std::make_pair(i, true);
+            return i+1;
         }
     }
-    return std::make_pair(i, false);
+    return 0;
+}
+
+/// Drop `n` bytes from the front of the receive buffer. The bytes
+/// are not actually moved until the next read, so that string_views
+/// into the buffer stay valid until then.
+void ServerSocket::consume_rx(size_t n)
+{
+    _rx_start += n;
+    _rx_scan = _rx_start;
+    _rx_iac = false;
+}
+
+/// Make room for at least `chunk` more bytes at the end of the
+/// receive buffer. This is a sliding window, rather than a ring:
+/// unconsumed bytes are moved to the front, but only when that is
+/// cheap, so as to not memmove on every line.
+void ServerSocket::reserve_rx(size_t chunk)
+{
+    if (_rx_start == _rx_end)
+    {
+        _rx_start = 0;
+        _rx_scan = 0;
+        _rx_end = 0;
+    }
+    else if (65536 < _rx_start and _rx_end < 2 * _rx_start)
+    {
+        memmove(&_rx_buf[0], &_rx_buf[_rx_start], _rx_end - _rx_start);
+        _rx_scan -= _rx_start;
+        _rx_end -= _rx_start;
+        _rx_start = 0;
+    }
+
+    if (_rx_buf.size() < _rx_end + chunk)
+        _rx_buf.resize(_rx_end + chunk);
+}
+
+static constexpr size_t RX_CHUNK = 16384;
+
+/// Blocking read of whatever data is available on the socket.
+/// Throws asio system_error on EOF and other errors.
+void ServerSocket::fill_rx_buf(void)
+{
+    reserve_rx(RX_CHUNK);
+    _rx_end += _socket->read_some(
+        asio::buffer(&_rx_buf[_rx_end], _rx_buf.size() - _rx_end));
+}
+
+/// Non-blocking read of whatever data is available on the socket.
+/// Return false on EOF or error.
+bool ServerSocket::try_fill_rx_buf(void)
+{
+    reserve_rx(RX_CHUNK);
+    ssize_t got = recv(_socket->native_handle(), &_rx_buf[_rx_end],
+                       _rx_buf.size() - _rx_end, MSG_DONTWAIT);
+    if (got < 0 and (EAGAIN == errno or EWOULDBLOCK == errno or EINTR == errno))
+        return true;
+    if (got <= 0)
+        return false;
+    _rx_end += got;
+    return true;
 }
 
-/// Read a single newline-delimited line from the socket.
+/// Extract a single newline-delimited line from the receive buffer.
 /// Return immediately if a ctrl-C or ctrl-D is found.
-std::string ServerSocket::get_telnet_line(asio::streambuf& b)
+bool ServerSocket::extract_line(std::string_view& line)
 {
-    asio::read_until(*_socket, b, match_eol_or_escape);
-    std::istream is(&b);
-    std::string line;
-    std::getline(is, line);
-    return line;
+    const char* base = _rx_buf.data();
+    size_t m = match_eol_or_escape(base + _rx_scan,
+                                   _rx_end - _rx_scan, _rx_iac);
+    if (0 == m)
+    {
+        _rx_scan = _rx_end;
+        return false;
+    }
+
+    // Escape chars are delivered along with the rest of the line,
+    // up to the next newline, if there is one.
+    size_t from = _rx_scan + m - 1;
+    const char* nl = (const char*) memchr(base + from, '\n', _rx_end - from);
+    size_t len = (nullptr == nl) ? _rx_end - _rx_start : nl - base - _rx_start;
+    line = std::string_view(base + _rx_start, len);
+    consume_rx((nullptr == nl) ? len : len + 1);
+    return true;
 }
 
-/// Read _content_length bytes from the socket.
-std::string ServerSocket::get_http_body(asio::streambuf& b)
+/// Extract one HTTP request header, or one request body, from the
+/// receive buffer. A header is parsed all at once, after the blank
+/// line that ends it has arrived. The parsed fields are left in the
+/// socket, and the unit returned for the header is empty. Requests
+/// that are pipelined behind this one stay in the buffer.
+bool ServerSocket::extract_http(std::string_view& unit)
 {
-    if (_content_length == 0) return "";
+    char* base = &_rx_buf[_rx_start];
+    size_t avail = _rx_end - _rx_start;
 
-    // Need to read more data
-    if (b.size() < _content_length)
+    if (_in_http_body)
     {
-        size_t remaining = _content_length - b.size();
-        asio::read(*_socket, b,
-            asio::transfer_exactly(remaining));
+        if (not _chunked)
+        {
+            if (avail < _content_length) return false;
+            unit = std::string_view(base, _content_length);
+            consume_rx(_content_length);
+            return true;
+        }
+
+        size_t blen = 0;
+        size_t used = 0;
+        HttpRequest::Result rc = _dechunk.decode(base, avail, blen, used);
+        if (HttpRequest::INCOMPLETE == rc) return false;
+        if (HttpRequest::COMPLETE != rc) http_error(rc);
+        unit = std::string_view(base, blen);
+        consume_rx(used);
+        return true;
     }
 
-    std::string body;
-    body.resize(_content_length);
-    std::istream is(&b);
-    is.read(&body[0], _content_length);
-    return body;
+    // Blank lines between requests are allowed, and are skipped.
+    while (0 < avail and ('\r' == base[0] or '\n' == base[0]))
+    {
+        consume_rx(1);
+        base++;
+        avail--;
+    }
+
+    // Look for the blank line that ends the header. The scan resumes
+    // where it left off, so that a header that arrives in pieces is
+    // not searched again and again.
+    size_t from = _rx_scan - _rx_start;
+    bool found = false;
+    while (not found)
+    {
+        const char* nl = (const char*) memchr(base + from, '\n', avail - from);
+        if (nullptr == nl)
+        {
+            from = avail;
+            break;
+        }
+
+        // Is the next line empty?
+        size_t i = nl - base;
+        size_t next = i + 1;
+        if (next < avail and '\r' == base[next]) next++;
+        if (avail <= next)
+        {
+            from = i;
+            break;
+        }
+        found = ('\n' == base[next]);
+        from = i + 1;
+    }
+
+    if (not found)
+    {
+        _rx_scan = _rx_start + from;
+        if (HttpRequest::MAX_HEADER_BYTES < avail)
+            http_error(HttpRequest::TOO_LARGE);
+        return false;
+    }
+
+    HttpRequest req;
+    HttpRequest::Result rc = req.parse(base, avail);
+    if (HttpRequest::COMPLETE != rc) http_error(rc);
+    if ("GET" != req.method and "POST" != req.method)
+        http_error(HttpRequest::NOT_IMPLEMENTED);
+
+    // Copy out what the users of this class look at; the views
+    // are into the receive buffer, and won't stay valid.
+    _url.assign(req.target);
+    _host_header.assign(req.host);
+    _if_none_match.assign(req.if_none_match);
+    _if_modified_since.assign(req.if_modified_since);
+    _webkey.assign(req.websocket_key);
+    _ws_extensions.assign(req.websocket_extensions);
+    _accept_gzip = req.accept_gzip;
+    _got_websock_header = req.upgrade_websocket;
+    _keep_alive = req.keep_alive;
+    _http_version = req.version;
+    _content_length = req.content_length;
+    _chunked = req.chunked;
+    _dechunk.reset();
+
+    consume_rx(req.header_length);
+    _got_http_header = true;
+    unit = std::string_view();
+    return true;
+}
+
+/// Reply with an HTTP error status, and close the connection.
+void ServerSocket::http_error(HttpRequest::Result rc)
+{
+    const char* status = "400 Bad Request";
+    if (HttpRequest::TOO_LARGE == rc)
+        status = "431 Request Header Fields Too Large";
+    else if (HttpRequest::BODY_TOO_LARGE == rc)
+        status = "413 Content Too Large";
+    else if (HttpRequest::NOT_IMPLEMENTED == rc)
+        status = "501 Not Implemented";
+
+    std::string reply = "HTTP/1.1 ";
+    reply += status;
+    reply += "\r\n"
+        "Server: CogServer\r\n"
+        "Content-Length: 0\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+    Send(reply);
+    throw SilentException();
+}
+
+/// Extract one unit of input from the receive buffer: either a
+/// websocket frame, or an HTTP header or body, or a line of text.
+/// The unit is a view into the receive buffer, valid until the next
+/// read.
+bool ServerSocket::extract(std::string_view& unit)
+{
+    if (_do_frame_io)
+        return extract_websocket(unit);
+
+    if (_is_http_socket)
+        return extract_http(unit);
+
+    return extract_line(unit);
 }
 
 // ==================================================================
 
+/// Process one unit of input. Return false if the socket should
+/// be closed.
+bool ServerSocket::dispatch(std::string_view line)
+{
+    // HTTP requests come as a header, and then a body. The body is
+    // passed on as-is, without any line discipline.
+    if (_is_http_socket and not _do_frame_io)
+    {
+        _last_activity.store(time(nullptr), std::memory_order_relaxed);
+        _status.store(QUING, std::memory_order_relaxed);
+
+        if (_got_http_header)
+        {
+            _got_http_header = false;
+            _line_count.fetch_add(1, std::memory_order_relaxed);
+            total_line_count.fetch_add(1, std::memory_order_relaxed);
+
+            // Hand the request to the user. After a websocket upgrade,
+            // all that follows are frames.
+            Handshake();
+            if (not _do_frame_io)
+                _in_http_body = true;
+            return true;
+        }
+
+        _in_http_body = false;
+        OnLine(line);
+
+        // Reset for next HTTP request.
+        _content_length = 0;
+        _chunked = false;
+        _if_none_match.clear();
+        _if_modified_since.clear();
+        return _keep_alive;
+    }
+
+    // Binary websocket messages are passed on untouched.
+    if (not (_do_frame_io and _ws_binary))
+    {
+        // Some local Linux D-Bus daemon desperately wants to
+        // talk to us, sending us binary garbage of some kind.
+        // Desperately ignore it.
+        if (1 < line.size() and
+            0x1 == line[0] and 0x21 == line[1]) return false;
+
+        // Strip off carriage returns. The line already stripped
+        // newlines.
+        if (not line.empty() and line.back() == '\r')
+            line.remove_suffix(1);
+    }
+
+    _last_activity.store(time(nullptr), std::memory_order_relaxed);
+    _line_count.fetch_add(1, std::memory_order_relaxed);
+    total_line_count.fetch_add(1, std::memory_order_relaxed);
+    _status.store(QUING, std::memory_order_relaxed);
+
+    OnLine(line);
+    return true;
+}
+
+// ==================================================================
+
+void ServerSocket::start_connection(void)
+{
+    // telnet sockets have no setup to do.
+    if (not _is_http_socket)
+        OnConnection();
+}
+
 // This method is called in a new thread, when a new network connection
 // is made. It handles all socket reads for that socket.
 void ServerSocket::handle_connection(void)
@@ -313,84 +963,29 @@ void ServerSocket::handle_connection(void)
     _pth = pthread_self();
     logger().debug("ServerSocket::handle_connection()");
 
-    // telnet sockets have no setup to do.
-    if (not _is_http_socket)
-        OnConnection();
-    asio::streambuf b;
+    start_connection();
+    std::string_view line;
     while (true)
     {
         try
         {
-            _status = IWAIT;
-            std::string line;
-            if (not _do_frame_io)
-                line = get_telnet_line(b);
-            else
-                line = get_websocket_line();
-
-            // Some local Linux D-Bus daemon desperately wants to
-            // talk to us, sending us binary garbage of some kind.
-            // Desperately ignore it.
-            if (1 < line.size() and
-                0x1 == line.c_str()[0] and 0x21 == line.c_str()[1]) break;
-
-            // Strip off carriage returns. The line already stripped
-            // newlines.
-            if (not line.empty() and line[line.length()-1] == '\r') {
-                line.erase(line.end()-1);
-            }
-
-            _last_activity = time(nullptr);
-            _line_count++;
-            total_line_count++;
-            _status = QUING;
-
-            // If its not an http sock, then the API is simple.
-            if (not _is_http_socket)
-                OnLine(line);
-            else
+            // Handle everything that is already buffered, before
+            // going back to the socket for more.
+            if (extract(line))
             {
-                // Bypass until we've received the full HTTP header.
-                if (not _got_http_header)
-                    HandshakeLine(line);
-                if (_got_http_header)
-                {
-                    // Process the complete HTTP request
-                    // If we're running websockets, then we're doing
-                    // frame I/O and we've already got the line.
-                    // Otherwise, we use http Content-Length.
-                    if (_do_frame_io)
-                        OnLine(line);
-                    else
-                    {
-                        std::string http_body(get_http_body(b));
-                        OnLine(http_body);
-
-                        // Reset for next HTTP request.
-                        _got_http_header = false;
-                        _got_first_line = false;
-                        _content_length = 0;
-                    }
-                }
+                if (not dispatch(line)) break;
+                continue;
             }
+            wait_unthrottled();
+            _status.store(IWAIT, std::memory_order_relaxed);
+            fill_rx_buf();
         }
         catch (const std::system_error& e)
         {
             if (e.code() == asio::error::eof) {
-                // EOF received, but there may still be data in the socket
-                // buffer that hasn't been read yet. Try to drain it before
-                // breaking. This handles the case where a client sends
-                // multiple commands and immediately closes (nc -q 0).
-                try {
-                    std::error_code ec;
-                    size_t avail = _socket->available(ec);
-                    if (not ec and 0 < avail) {
-                        asio::read(*_socket, b, asio::transfer_exactly(avail), ec);
-                        // If we successfully read more data, continue the loop
-                        // to process it. Otherwise, break out.
-                        if (not ec) continue;
-                    }
-                } catch (...) {}
+                // Everything the client sent before closing is
+                // already sitting in the receive buffer, and has
+                // been processed, above.
                 break;
             } else if (e.code() == asio::error::connection_reset) {
                 break;
@@ -409,6 +1004,43 @@ void ServerSocket::handle_connection(void)
         }
     }
 
+    finish_connection();
+}
+
+/// Called by the Reactor, when there is data to be read.
+/// Reads what is available, and processes all complete units.
+/// Return false if the connection is closed, or should be closed.
+bool ServerSocket::on_readable(void)
+{
+    if (not try_fill_rx_buf()) return false;
+
+    try
+    {
+        std::string_view line;
+        while (extract(line))
+        {
+            if (not dispatch(line)) return false;
+        }
+    }
+    catch (const std::system_error& e)
+    {
+        if (e.code() != asio::error::eof and
+            e.code() != asio::error::connection_reset and
+            e.code() != asio::error::not_connected and
+            e.code() != asio::error::bad_descriptor)
+            logger().error("ServerSocket::on_readable(): Error processing data. Message: %s", e.what());
+        return false;
+    }
+    catch (const SilentException& e)
+    {
+        return false;
+    }
+    _status.store(IWAIT, std::memory_order_relaxed);
+    return true;
+}
+
+void ServerSocket::finish_connection(void)
+{
     _last_activity = time(nullptr);
     _status = CLOSE;
 
@@ -421,16 +1053,19 @@ void ServerSocket::handle_connection(void)
         // strings issued from netcat, that simply did not have
         // newlines at the end. There may be multiple lines buffered,
         // so drain all of them.
-        std::istream is(&b);
-        std::string line;
-        while (std::getline(is, line))
+        std::string_view rest(_rx_buf.data() + _rx_start, _rx_end - _rx_start);
+        while (not rest.empty())
         {
-            if (not line.empty() and line[line.length()-1] == '\r') {
-                line.erase(line.end()-1);
-            }
+            size_t eol = rest.find('\n');
+            if (std::string_view::npos == eol) eol = rest.size();
+            std::string_view line = rest.substr(0, eol);
+            rest.remove_prefix(std::min(eol + 1, rest.size()));
+            if (not line.empty() and line.back() == '\r')
+                line.remove_suffix(1);
             if (not line.empty())
                 OnLine(line);
         }
+        _rx_start = _rx_end;
     }
 
     logger().debug("ServerSocket::exiting handle_connection()");
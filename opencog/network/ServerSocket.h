@@ -10,13 +10,24 @@
 #define _OPENCOG_SERVER_SOCKET_H
 
 #include <atomic>
+#include <condition_variable>
+#include <initializer_list>
+#include <mutex>
+#include <string>
+#include <string_view>
 #include <pthread.h>
 #include <asio.hpp>
 
+#include <opencog/network/HttpParser.h>
+
 namespace opencog
 {
 
 class SocketManager;
+class Reactor;
+class HandlerPool;
+class Deflater;
+class Inflater;
 
 /** \addtogroup grp_server
  *  @{
@@ -27,8 +38,13 @@ class SocketManager;
  * to the server. It handles all socket read/write for that client.
  *
  * When a client connects to the server, the ServerSocket::handle_connection()
- * method is called in a new thread (and thus all socket reads for that
- * client occur in this thread.)
+ * method is called in a handler thread (and thus all socket reads for that
+ * client occur in this thread.) Handler threads are recycled from a
+ * HandlerPool, rather than being created anew for each connection.
+ * Alternately, the socket can be handed to a Reactor, in which case a
+ * small, fixed pool of reactor threads perform all socket reads, for
+ * all connections. In either case, the same OnConnection() and OnLine()
+ * callbacks are made.
  *
  * This class has two pure-virtual methods: OnConnection() and OnLine().
  * The OnConnection() method is called once, when the reader thread is
@@ -50,25 +66,109 @@ private:
     // Socket manager handles registration and coordination
     SocketManager* _socket_manager;
 
-    // Read a newline-delimited line of text from socket.
-    std::string get_telnet_line(asio::streambuf&);
+    // Set if this socket holds one of the SocketManager's slots.
+    bool _has_slot;
+
+    // Refuse the connection with a "server busy" reply, and delete.
+    void reject(void);
+
+    // The reactor that polls this socket, if any. If null, then
+    // handle_connection() is polling the socket in its own thread.
+    Reactor* _reactor;
+    int _epfd;         // The reactor's epoll set holding this socket.
+
+    // The pool that the server runs its handlers on, if any.
+    HandlerPool* _pool;
+
+    // Input flow control; see throttle_input().
+    std::mutex _throttle_mtx;
+    std::condition_variable _throttle_cv;
+    bool _input_throttled;
+    void wait_unthrottled(void);
+
+    // Receive buffer. Everything read from the socket lands here,
+    // and is then carved up into lines, HTTP bodies or websocket
+    // frames. Bytes before _rx_start have already been consumed;
+    // bytes from _rx_end onwards are free space.
+    std::string _rx_buf;
+    size_t _rx_start;
+    size_t _rx_end;
+    size_t _rx_scan;   // Resume point for the end-of-line scan
+    bool _rx_iac;      // Scan has seen a telnet IAC
+
+    // Read more data from the socket into the receive buffer.
+    // The blocking variant is used by handle_connection(); the
+    // non-blocking one by the Reactor.
+    void fill_rx_buf(void);
+    bool try_fill_rx_buf(void);
+    void reserve_rx(size_t);
+    void consume_rx(size_t);
+
+    // Extract one unit of input (a line of text, an HTTP body, or
+    // a websocket frame) from the receive buffer. Return false if
+    // the buffer does not yet hold a complete unit.
+    bool extract(std::string_view&);
+    bool extract_line(std::string_view&);
+    bool extract_http(std::string_view&);
+    bool extract_websocket(std::string_view&);
+
+    // Process one unit of input. Return false to close the socket.
+    bool dispatch(std::string_view);
+
+    // Reused by the default OnLine(std::string_view).
+    std::string _line_buf;
+
+    // Output batching; see set_output_batching(). The settings may
+    // be changed by another thread; they are written under _out_mtx.
+    std::mutex _out_mtx;
+    std::string _out_buf;
+    std::atomic_size_t _batch_bytes;
+    std::atomic_uint _batch_usec;
+    bool _corked;      // Last write had MSG_MORE; guarded by _out_mtx.
+    void send_batched(const std::string&);
+    void flush_locked(void);
+    void write_out(const char*, size_t, bool);
 
-    // Read _content_length bytes
-    std::string get_http_body(asio::streambuf&);
+    // Connection setup and teardown, shared by handle_connection()
+    // and the Reactor.
+    void start_connection(void);
+    bool on_readable(void);
+    void finish_connection(void);
 
     // Send an asio buffer that has data in it.
     void Send(const asio::const_buffer&);
 
-    // WebSocket state machine; unused in the telnet interface.
-    bool _got_first_line;
+    // HTTP and WebSocket state; unused in the telnet interface.
+    // A parsed header is handed to Handshake(), and then the body
+    // is read; requests that are pipelined behind it wait their turn
+    // in the receive buffer.
     bool _got_http_header;
+    bool _in_http_body;
+    bool _chunked;
+    HttpChunkDecoder _dechunk;
     bool _do_frame_io;
     std::string _webkey;
-    void HandshakeLine(const std::string&);
-    std::string get_websocket_data(void);
-    std::string get_websocket_line(void);
+    std::string _ws_extensions;
+    void Handshake(void);
+    [[noreturn]] void http_error(HttpRequest::Result);
     void send_websocket_pong(void);
-    void send_websocket(const std::string&);
+    void send_websocket_close(uint16_t);
+    void send_websocket(const std::string&, bool binary = false);
+    std::mutex _ws_send_mtx;
+
+    // Reassembly of messages that arrive in several frames.
+    std::string _ws_message;
+    bool _ws_fragmented;
+    bool _ws_msg_compressed;
+
+    // The websocket permessage-deflate extension (RFC 7692), if it
+    // was negotiated. Both directions are without context takeover,
+    // so each message is compressed on its own. Incoming messages
+    // are decompressed into _ws_inflated.
+    std::string negotiate_deflate(void);
+    Deflater* _ws_deflater;
+    Inflater* _ws_inflater;
+    std::string _ws_inflated;
 
 protected:
     // WebSocket stuff that users will be interested in.
@@ -76,9 +176,22 @@ protected:
     bool _got_websock_header;
     bool _is_mcp_socket;
 
+    // Set if the websocket message being handled in OnLine() was
+    // sent as binary data, rather than as text.
+    bool _ws_binary;
+
     // KeepAlive connections will repeatedly send HTTP headers.
+    // Set for HTTP/1.1, unless the client asked for `Connection:
+    // close`, and for HTTP/1.0 with `Connection: keep-alive`. If it
+    // is not set, the connection is closed after the reply.
     bool _keep_alive;
 
+    // 11 for HTTP/1.1, 10 for HTTP/1.0.
+    int _http_version;
+
+    // The client takes gzip'ed replies (Accept-Encoding).
+    bool _accept_gzip;
+
     bool _in_barrier;
 
     size_t _content_length;
@@ -86,8 +199,14 @@ protected:
     std::string _url;
     std::string _host_header;  // Host header from HTTP request
 
+    // Conditional request headers, for static pages.
+    std::string _if_none_match;
+    std::string _if_modified_since;
+
     /**
-     * Connection callback: called whenever a new connection arrives
+     * Connection callback: called whenever a new connection arrives.
+     * For HTTP sockets, it is called once for each request header,
+     * and then OnLine() is called once, with the request body.
      */
     virtual void OnConnection(void) = 0;
 
@@ -96,18 +215,46 @@ protected:
      */
     virtual void OnLine (const std::string&) = 0;
 
+    /**
+     * Callback: called when a client has sent us a line of text.
+     * The view points into the receive buffer, and is valid only
+     * for the duration of the call. Override this to avoid copying
+     * each line; the default copies it into a (reused) string, and
+     * calls the method above.
+     */
+    virtual void OnLine (std::string_view);
+
     /**
      * Report human-readable stats for this socket.
      */
     time_t _start_time;
     pid_t _tid;    // OS-dependent thread ID.
     pthread_t _pth;
-    const char* _status; // "start" or "run" or "close"
-    time_t _last_activity;
-    size_t _line_count;
+    // Read by the stats display while the socket is in use, so these
+    // are atomics; updates on the per-line path are relaxed.
+    std::atomic<const char*> _status; // "start" or "run" or "close"
+    std::atomic<time_t> _last_activity;
+    std::atomic_size_t _line_count;
+
+    /**
+     * Return true if OnLine() might block for a while, e.g. because
+     * it evaluates a request right there. A Reactor asks before each
+     * read, and if so, does the read, and calls OnLine(), on a pool
+     * thread, so that its other sockets are not held up. Sockets that
+     * only enqueue their input can leave this as is.
+     */
+    virtual bool handler_may_block(void) { return false; }
 
     virtual std::string connection_header(void);
     virtual std::string connection_stats(void);
+
+    // Socket kind, as shown in the stats: `T` telnet, `W` websocket,
+    // `H` http, `M` MCP.
+    char kind(void) const
+    {
+        return _do_frame_io ? 'W' :
+            (_is_http_socket ? 'H' : (_is_mcp_socket ? 'M' : 'T'));
+    }
 public:
     ServerSocket(SocketManager*);
     virtual ~ServerSocket();
@@ -117,6 +264,11 @@ public:
     // Access to socket manager for derived classes
     SocketManager* get_socket_manager() { return _socket_manager; }
 
+    // Derived classes may run helper tasks on the server's pool,
+    // rather than spawning threads of their own.
+    void set_handler_pool(HandlerPool* pool) { _pool = pool; }
+    HandlerPool* get_handler_pool() { return _pool; }
+
     void set_connection(asio::ip::tcp::socket*);
     void handle_connection(void);
 
@@ -125,6 +277,48 @@ public:
      */
     void Send(const std::string&);
 
+    /**
+     * Send several buffers with a single (gathering) write, e.g.
+     * a header and a body, without first copying them together.
+     * The buffers are sent as-is; no websocket framing is done.
+     */
+    void Send(std::initializer_list<asio::const_buffer>);
+
+    /**
+     * Send binary data to the client. On a websocket, this is sent
+     * as a binary message, instead of as text; otherwise, it is sent
+     * as-is, just like Send().
+     */
+    void SendBinary(const std::string&);
+
+    /**
+     * Send a header, followed by `len` bytes of the open file `fd`,
+     * starting at `offset`. The file contents go from the page cache
+     * to the socket with sendfile(), without a copy through user
+     * space. No websocket framing is done.
+     */
+    void SendFile(const std::string& header, int fd, off_t offset, size_t len);
+
+    /**
+     * Stop (or resume) reading from the socket. Used by shells whose
+     * work queue has filled up, so that a client sending faster than
+     * the server can evaluate gets TCP backpressure, instead of having
+     * its input buffered without bound. Lines that were already
+     * received are still delivered.
+     */
+    void throttle_input(bool);
+
+    /**
+     * Batch up output: hold replies until `bytes` have accumulated,
+     * or until `usec` microseconds have passed since the first one,
+     * or until flush_output() is called, whichever comes first.
+     * This cuts down on syscalls and packets for clients that pipeline
+     * many small commands. Zero bytes disables batching (the default).
+     * Not used for websockets.
+     */
+    void set_output_batching(size_t bytes, unsigned int usec);
+    void flush_output(void);
+
     /**
      * Close this socket. Called from a thread other than
      * the one that is actually polling the socket.
@@ -140,6 +334,7 @@ public:
     static char IWAIT[6];
     static char QUING[6];
     static char BAR[6];
+    static char STALL[6];
     static char DTOR[6];
     static char CLOSE[6];
     static char DOWN[6];
@@ -147,6 +342,7 @@ public:
     // Expose frequently-needed socket manager operations
     // These delegate to the socket manager for this socket
     friend class SocketManager;
+    friend class Reactor;
 }; // class
 
 /** @}*/
@@ -6,7 +6,13 @@
  * SPDX-License-Identifier: AGPL-3.0-or-later
  */
 
+#include <errno.h>
+#include <string.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/prctl.h>
 #include <sys/resource.h>
+#include <sys/socket.h>
 #include <time.h>
 #include <unistd.h>
 #include <algorithm>
@@ -22,12 +28,55 @@
 using namespace opencog;
 
 SocketManager::SocketManager()
-	: _max_open_sockets(0),
+	: _snap_gen(0),
+	  _max_open_sockets(0),
 	  _num_open_sockets(0),
 	  _num_open_stalls(0),
+	  _limit_thread(nullptr),
+	  _limit_stop(false),
+	  _limit_min(0),
+	  _limit_max(0),
+	  _lat_ewma_ms(0.0),
+	  _lat_base_ms(0.0),
+	  _lat_samples(0),
+	  _runq(0),
+	  _admit_depth(256),
+	  _admit_deadline_ms(0),
+	  _admit_thread(nullptr),
+	  _admit_stop(false),
+	  _admitting(false),
+	  _num_rejected(0),
+	  _num_admit_waits(0),
+	  _admit_wait_total_ms(0.0),
+	  _admit_wait_max_ms(0.0),
 	  _global_barrier_active(false),
+	  _busy_shells(0),
+	  _barrier_waiters(0),
+	  _num_barriers(0),
+	  _barrier_wait_total_ms(0.0),
+	  _barrier_wait_max_ms(0.0),
+	  _recv_barrier_timeout_ms(0),
+	  _recv_barriers_done(0),
+	  _recv_barriers_failed(0),
+	  _recv_skew_total_ms(0.0),
+	  _recv_skew_max_ms(0.0),
+	  _recv_waits(0),
+	  _recv_wait_total_ms(0.0),
+	  _recv_wait_max_ms(0.0),
+	  _flushing(nullptr),
+	  _flush_thread(nullptr),
+	  _flush_stop(false),
+	  _reaper_thread(nullptr),
+	  _reaper_stop(false),
+	  _idle_secs{0, 0, 0, 0},
+	  _num_reaped{0, 0, 0, 0},
+	  _ka_idle(0),
+	  _ka_intvl(0),
+	  _ka_count(0),
 	  _network_gone(false)
 {
+	publish(new SockList);
+
 	// Set max open sockets to number of hardware CPUs
 	unsigned int hwlim = std::thread::hardware_concurrency();
 	if (0 == hwlim) hwlim = 32;
@@ -67,35 +116,478 @@ SocketManager::SocketManager()
 
 SocketManager::~SocketManager()
 {
+	{
+		std::lock_guard<std::mutex> lck(_max_mtx);
+		_admit_stop = true;
+		_max_cv.notify_all();
+	}
+	if (_admit_thread)
+	{
+		_admit_thread->join();
+		delete _admit_thread;
+	}
+
+	{
+		std::lock_guard<std::mutex> lck(_max_mtx);
+		_limit_stop = true;
+		_max_cv.notify_all();
+	}
+	if (_limit_thread)
+	{
+		_limit_thread->join();
+		delete _limit_thread;
+	}
+
+	{
+		std::lock_guard<std::mutex> lck(_flush_mtx);
+		_flush_stop = true;
+		_flush_cv.notify_all();
+	}
+	if (_flush_thread)
+	{
+		_flush_thread->join();
+		delete _flush_thread;
+	}
+
+	{
+		std::lock_guard<std::mutex> lck(_reaper_mtx);
+		_reaper_stop = true;
+		_reaper_cv.notify_all();
+	}
+	if (_reaper_thread)
+	{
+		_reaper_thread->join();
+		delete _reaper_thread;
+	}
+}
+
+/// Make `list` the current registry snapshot; return its generation.
+/// Caller must hold _sock_lock.
+uint64_t SocketManager::publish(SockList* list)
+{
+	uint64_t gen = ++_snap_gen;
+	{
+		std::lock_guard<std::mutex> lck(_rcu_mtx);
+		_live_snaps.insert(gen);
+	}
+	std::shared_ptr<const SockList> snap(list,
+		[this, gen](const SockList* l)
+		{
+			delete l;
+			std::lock_guard<std::mutex> lck(_rcu_mtx);
+			_live_snaps.erase(gen);
+			_rcu_cv.notify_all();
+		});
+	std::atomic_store(&_sock_snap, snap);
+	return gen;
 }
 
 void SocketManager::add_sock(ServerSocket* ss)
 {
 	std::lock_guard<std::mutex> lock(_sock_lock);
-	_sock_list.insert(ss);
+	SockList* list = new SockList(*sockets());
+	list->push_back(ss);
+	publish(list);
 }
 
 void SocketManager::rem_sock(ServerSocket* ss)
 {
-	std::lock_guard<std::mutex> lock(_sock_lock);
-	_sock_list.erase(ss);
+	uint64_t gen;
+	{
+		std::lock_guard<std::mutex> lock(_sock_lock);
+		SockList* list = new SockList(*sockets());
+		list->erase(std::remove(list->begin(), list->end(), ss), list->end());
+		gen = publish(list);
+	}
+
+	// Grace period. Readers may still be looking at the socket
+	// through any older snapshot, not just the one before this;
+	// wait for all of them to finish, because our caller is about
+	// to destroy it. Snapshots are dropped in no particular order,
+	// so wait for the oldest one still alive.
+	std::unique_lock<std::mutex> lck(_rcu_mtx);
+	_rcu_cv.wait(lck, [this, gen]
+		{ return _live_snaps.empty() or gen <= *_live_snaps.begin(); });
+}
+
+void SocketManager::set_max_open_sockets(unsigned int m)
+{
+	std::lock_guard<std::mutex> lck(_max_mtx);
+	_max_open_sockets = m;
+
+	// Raising the limit may allow parked sockets in.
+	_max_cv.notify_all();
 }
 
-void SocketManager::wait_available_slot()
+void SocketManager::set_adaptive_limit(unsigned int min, unsigned int max)
 {
+	std::lock_guard<std::mutex> lck(_max_mtx);
+	_limit_min = std::max(1u, std::min(min, max));
+	_limit_max = max;
+	if (0 == max) return;
+
+	_max_open_sockets = std::max(_limit_min,
+		std::min(_max_open_sockets, _limit_max));
+	_max_cv.notify_all();
+	if (nullptr == _limit_thread)
+		_limit_thread = new std::thread(&SocketManager::limit_loop, this);
+}
+
+void SocketManager::record_latency(double ms)
+{
+	std::lock_guard<std::mutex> lck(_lat_mtx);
+	if (0 == _lat_samples++)
+	{
+		_lat_ewma_ms = ms;
+		_lat_base_ms = ms;
+		return;
+	}
+	_lat_ewma_ms += 0.1 * (ms - _lat_ewma_ms);
+	if (_lat_ewma_ms < _lat_base_ms) _lat_base_ms = _lat_ewma_ms;
+}
+
+// Number of currently runnable threads, system-wide, from the
+// fourth field of /proc/loadavg.
+static unsigned int runnable_threads(void)
+{
+	unsigned int nrun = 0;
+	FILE* fh = fopen("/proc/loadavg", "r");
+	if (nullptr == fh) return 0;
+	if (1 != fscanf(fh, "%*f %*f %*f %u/", &nrun)) nrun = 0;
+	fclose(fh);
+	return nrun;
+}
+
+/// AIMD control of _max_open_sockets. Grow by one while there is
+/// demand (connections waiting for a slot, or all slots in use), and
+/// the server is keeping up; shrink by a quarter when it's not.
+void SocketManager::limit_loop(void)
+{
+	prctl(PR_SET_NAME, "cogserv:limit", 0, 0, 0);
+
+	unsigned int ncpu = std::thread::hardware_concurrency();
+	if (0 == ncpu) ncpu = 1;
+
+	// _max_cv is notified for many other reasons; those wakeups
+	// must not be counted as ticks.
+	auto tick = std::chrono::steady_clock::now();
 	std::unique_lock<std::mutex> lck(_max_mtx);
-	_num_open_sockets++;
+	while (not _limit_stop)
+	{
+		tick += std::chrono::seconds(1);
+		if (_max_cv.wait_until(lck, tick, [this] { return _limit_stop; }))
+			break;
+		if (0 == _limit_max) continue;
+
+		double lat, base;
+		{
+			std::lock_guard<std::mutex> llck(_lat_mtx);
+			lat = _lat_ewma_ms;
+			base = _lat_base_ms;
+
+			// Let the baseline drift upwards, slowly, so that it
+			// tracks changes in the workload.
+			_lat_base_ms += 0.01 * (_lat_ewma_ms - _lat_base_ms);
+		}
+		_runq = runnable_threads();
+
+		unsigned int limit = _max_open_sockets;
+		bool overloaded = (0.0 < base and 2.0 * base < lat and 1.0 < lat)
+			or (3 * ncpu < 2 * _runq);
+		bool demand = not _admit_queue.empty() or
+			_max_open_sockets <= _num_open_sockets;
 
-	// If we are just below the max limit, send a half-ping in an
-	// attempt to force any half-open connections to close.
+		if (overloaded)
+			limit = std::max(_limit_min, (3 * limit) / 4);
+		else if (demand)
+			limit = std::min(_limit_max, limit + 1);
+		else
+			limit = std::max(_limit_min, std::min(limit, _limit_max));
+
+		if (limit == _max_open_sockets) continue;
+		_max_open_sockets = limit;
+		_limit_history.push_back(limit);
+		if (10 < _limit_history.size()) _limit_history.pop_front();
+
+		// A higher limit may let parked sockets in.
+		_max_cv.notify_all();
+	}
+}
+
+void SocketManager::set_admission_queue(size_t depth, unsigned int deadline_ms)
+{
+	std::lock_guard<std::mutex> lck(_max_mtx);
+	_admit_depth = depth;
+	_admit_deadline_ms = deadline_ms;
+	_max_cv.notify_all();
+}
+
+void SocketManager::set_barrier_timeout(unsigned int ms)
+{
+	std::lock_guard<std::mutex> lck(_recv_barrier_mtx);
+	_recv_barrier_timeout_ms = ms;
+}
+
+int SocketManager::kind_index(char kind)
+{
+	switch (kind)
+	{
+		case 'T': return 0;
+		case 'H': return 1;
+		case 'W': return 2;
+		case 'M': return 3;
+	}
+	return 0;
+}
+
+void SocketManager::set_idle_timeout(char kind, unsigned int secs)
+{
+	std::lock_guard<std::mutex> lck(_reaper_mtx);
+	_idle_secs[kind_index(kind)] = secs;
+	if (0 < secs and nullptr == _reaper_thread)
+		_reaper_thread = new std::thread(&SocketManager::reaper_loop, this);
+}
+
+void SocketManager::set_keepalive(unsigned int idle, unsigned int intvl,
+                                  unsigned int count)
+{
+	std::lock_guard<std::mutex> lck(_reaper_mtx);
+	_ka_idle = idle;
+	_ka_intvl = intvl;
+	_ka_count = count;
+}
+
+void SocketManager::set_keepalive_opts(int fd)
+{
+	std::lock_guard<std::mutex> lck(_reaper_mtx);
+	if (0 == _ka_idle) return;
+
+	int on = 1;
+	int idle = _ka_idle;
+	int intvl = 0 < _ka_intvl ? _ka_intvl : std::max(1u, _ka_idle / 3);
+	int count = 0 < _ka_count ? _ka_count : 3;
+	if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &on, sizeof(on)) or
+	    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle)) or
+	    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl)) or
+	    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &count, sizeof(count)))
+		logger().warn("[SocketManager] unable to set TCP keepalive: %s",
+			strerror(errno));
+}
+
+/// Close connections that have sat idle for too long. Runs once a
+/// second, so that slots get freed without anyone asking. Dead peers
+/// are found by TCP keepalive, and not by a half-ping from here.
+void SocketManager::reaper_loop(void)
+{
+	prctl(PR_SET_NAME, "cogserv:reaper", 0, 0, 0);
+
+	std::unique_lock<std::mutex> lck(_reaper_mtx);
+	while (not _reaper_stop)
+	{
+		_reaper_cv.wait_for(lck, std::chrono::seconds(1));
+		if (_reaper_stop or _network_gone) break;
+
+		unsigned int idle_secs[4];
+		std::copy(_idle_secs, _idle_secs + 4, idle_secs);
+		lck.unlock();
+
+		time_t now = time(nullptr);
+		auto snap = sockets();
+		for (ServerSocket* ss : *snap)
+		{
+			// Only sockets that are waiting for more input. Sockets
+			// that are busy, stalled or shutting down are left alone.
+			if (ss->_status != ServerSocket::IWAIT) continue;
+
+			int k = kind_index(ss->kind());
+			if (0 == idle_secs[k]) continue;
+			if (now - ss->_last_activity <= (time_t) idle_secs[k])
+				continue;
+
+			// A shell might still be evaluating, or printing.
+			ConsoleSocket* cs = dynamic_cast<ConsoleSocket*>(ss);
+			if (cs and cs->busyShell()) continue;
+
+			logger().info("[SocketManager] closing idle %c socket after %u secs",
+				ss->kind(), idle_secs[k]);
+			ss->Exit();
+			lck.lock();
+			_num_reaped[k]++;
+			lck.unlock();
+		}
+		lck.lock();
+	}
+}
+
+void SocketManager::admit(ServerSocket* ss,
+                          std::function<void(ServerSocket*)> start)
+{
+	// If we are at the max limit, send a half-ping in an attempt
+	// to force any half-open connections to close.
 	if (_max_open_sockets <= _num_open_sockets)
 		half_ping();
 
-	// Report how often we stall because we hit the max.
-	if (_max_open_sockets < _num_open_sockets)
-		_num_open_stalls ++;
+	{
+		std::lock_guard<std::mutex> lck(_max_mtx);
+
+		// Don't jump the queue, if others are already waiting.
+		if (_admit_queue.empty() and
+		    _num_open_sockets < _max_open_sockets)
+		{
+			_num_open_sockets++;
+			ss->_has_slot = true;
+		}
+		else if (_admit_queue.size() < _admit_depth and not _network_gone)
+		{
+			// Report how often we stall because we hit the max.
+			_num_open_stalls ++;
+			_admit_queue.push_back(
+				{ss, std::chrono::steady_clock::now(), start});
+
+			if (nullptr == _admit_thread)
+				_admit_thread = new std::thread(&SocketManager::admit_loop, this);
+			_max_cv.notify_all();
+			return;
+		}
+		else
+			_num_rejected ++;
+	}
+
+	if (ss->_has_slot)
+	{
+		ss->_status = ServerSocket::START;
+		start(ss);
+	}
+	else
+		ss->reject();
+}
+
+/// Hand out free slots to parked sockets, in arrival order, and
+/// turn away those that have waited past the deadline.
+void SocketManager::admit_loop(void)
+{
+	prctl(PR_SET_NAME, "cogserv:admit", 0, 0, 0);
+
+	std::unique_lock<std::mutex> lck(_max_mtx);
+	while (not _admit_stop)
+	{
+		auto now = std::chrono::steady_clock::now();
+		auto deadline = std::chrono::milliseconds(_admit_deadline_ms);
+
+		std::vector<ServerSocket*> expired;
+		std::vector<Parked> ready;
+		while (not _admit_queue.empty())
+		{
+			Parked& pk = _admit_queue.front();
+			if (0 < _admit_deadline_ms and pk.since + deadline <= now)
+			{
+				expired.push_back(pk.ss);
+				_num_rejected ++;
+			}
+			else if (_num_open_sockets < _max_open_sockets)
+			{
+				_num_open_sockets++;
+				pk.ss->_has_slot = true;
+
+				double waited = std::chrono::duration<double, std::milli>(
+					now - pk.since).count();
+				_num_admit_waits ++;
+				_admit_wait_total_ms += waited;
+				if (_admit_wait_max_ms < waited)
+					_admit_wait_max_ms = waited;
+				ready.push_back(pk);
+			}
+			else break;
+			_admit_queue.pop_front();
+		}
+
+		if (expired.empty() and ready.empty())
+		{
+			if (_admit_queue.empty() or 0 == _admit_deadline_ms)
+				_max_cv.wait(lck);
+			else
+				_max_cv.wait_until(lck, _admit_queue.front().since + deadline);
+			continue;
+		}
+
+		// Start and reject sockets without holding the lock; both
+		// may block on network I/O.
+		_admitting = true;
+		lck.unlock();
+		for (ServerSocket* ss : expired)
+			ss->reject();
+		for (Parked& pk : ready)
+		{
+			pk.ss->_status = ServerSocket::START;
+			pk.start(pk.ss);
+		}
+		lck.lock();
+		_admitting = false;
+		_max_cv.notify_all();
+	}
+}
+
+/// Arrange for the socket's batched output to be flushed, once the
+/// deadline has passed. One thread serves all sockets; it sleeps until
+/// the earliest deadline.
+void SocketManager::schedule_flush(ServerSocket* ss, unsigned int usec)
+{
+	auto when = std::chrono::steady_clock::now() +
+		std::chrono::microseconds(usec);
+
+	std::lock_guard<std::mutex> lck(_flush_mtx);
+	bool earliest = _flush_due.empty() or when < _flush_due.begin()->first;
+	_flush_due.emplace(when, ss);
+
+	if (nullptr == _flush_thread)
+		_flush_thread = new std::thread(&SocketManager::flush_loop, this);
+	else if (earliest)
+		_flush_cv.notify_all();
+}
+
+/// Called from the socket dtor. Upon return, the flush thread will
+/// no longer touch the socket.
+void SocketManager::cancel_flush(ServerSocket* ss)
+{
+	std::unique_lock<std::mutex> lck(_flush_mtx);
+	for (auto it = _flush_due.begin(); it != _flush_due.end(); )
+	{
+		if (it->second == ss) it = _flush_due.erase(it);
+		else it++;
+	}
+	_flush_cv.wait(lck, [this, ss] { return _flushing != ss; });
+}
+
+void SocketManager::flush_loop(void)
+{
+	prctl(PR_SET_NAME, "cogserv:flush", 0, 0, 0);
+
+	std::unique_lock<std::mutex> lck(_flush_mtx);
+	while (not _flush_stop)
+	{
+		if (_flush_due.empty())
+		{
+			_flush_cv.wait(lck);
+			continue;
+		}
 
-	while (_max_open_sockets < _num_open_sockets) _max_cv.wait(lck);
+		auto first = _flush_due.begin();
+		if (std::chrono::steady_clock::now() < first->first)
+		{
+			_flush_cv.wait_until(lck, first->first);
+			continue;
+		}
+
+		// Flush without holding the lock; the socket may be slow.
+		// The dtor waits in cancel_flush() until we are done.
+		_flushing = first->second;
+		_flush_due.erase(first);
+		lck.unlock();
+		_flushing->flush_output();
+		lck.lock();
+		_flushing = nullptr;
+		_flush_cv.notify_all();
+	}
 }
 
 void SocketManager::release_slot()
@@ -105,6 +597,22 @@ void SocketManager::release_slot()
 	_max_cv.notify_all();
 }
 
+void SocketManager::add_stats_source(const void* owner,
+                                     std::function<std::string()> src)
+{
+	std::lock_guard<std::mutex> lock(_stats_mtx);
+	_stats_sources.emplace_back(owner, src);
+}
+
+void SocketManager::rem_stats_source(const void* owner)
+{
+	std::lock_guard<std::mutex> lock(_stats_mtx);
+	_stats_sources.erase(
+		std::remove_if(_stats_sources.begin(), _stats_sources.end(),
+			[owner](const auto& pr) { return pr.first == owner; }),
+		_stats_sources.end());
+}
+
 std::string SocketManager::display_stats_full(const char* title, time_t start_time, int nlines)
 {
 	struct tm tm;
@@ -140,12 +648,78 @@ std::string SocketManager::display_stats_full(const char* title, time_t start_ti
 		nfd++;
 	}
 
-	char buff[180];
+	char buff[240];
 	snprintf(buff, sizeof(buff),
 		"max-open-socks: %d   cur-open-socks: %d   num-open-fds: %d  stalls: %zd\n",
 		_max_open_sockets, _num_open_sockets, nfd, _num_open_stalls);
 	rc += buff;
 
+	{
+		std::lock_guard<std::mutex> lck(_max_mtx);
+		double avg = 0 < _num_admit_waits ?
+			_admit_wait_total_ms / _num_admit_waits : 0.0;
+		snprintf(buff, sizeof(buff),
+			"admit-queue: %zu/%zu  deadline: %u ms  rejected: %zu  wait-avg: %.1f ms  wait-max: %.1f ms\n",
+			_admit_queue.size(), _admit_depth, _admit_deadline_ms,
+			_num_rejected, avg, _admit_wait_max_ms);
+	}
+	rc += buff;
+	if (0 < _limit_max)
+	{
+		std::string hist;
+		double lat, base;
+		{
+			std::lock_guard<std::mutex> lck(_lat_mtx);
+			lat = _lat_ewma_ms;
+			base = _lat_base_ms;
+		}
+		std::lock_guard<std::mutex> lck(_max_mtx);
+		for (unsigned int lim : _limit_history)
+			hist += " " + std::to_string(lim);
+		snprintf(buff, sizeof(buff),
+			"adaptive-limit: %u  range: %u-%u  eval-lat: %.2f ms  base: %.2f ms  runq: %u  history:%s\n",
+			_max_open_sockets, _limit_min, _limit_max,
+			lat, base, _runq, hist.c_str());
+		rc += buff;
+	}
+
+	rc += _output_dispatcher.display_stats();
+
+	{
+		std::lock_guard<std::mutex> lck(_reaper_mtx);
+		snprintf(buff, sizeof(buff),
+			"idle-reaper: T: %u/%zu  H: %u/%zu  W: %u/%zu  M: %u/%zu  keepalive: %u/%u/%u\n",
+			_idle_secs[0], _num_reaped[0], _idle_secs[1], _num_reaped[1],
+			_idle_secs[2], _num_reaped[2], _idle_secs[3], _num_reaped[3],
+			_ka_idle, _ka_intvl, _ka_count);
+	}
+	rc += buff;
+
+	{
+		std::lock_guard<std::mutex> lck(_global_barrier_mtx);
+		double avg = 0 < _num_barriers ?
+			_barrier_wait_total_ms / _num_barriers : 0.0;
+		snprintf(buff, sizeof(buff),
+			"global-barrier: %zu  waiting: %zu  busy-shells: %zu  wait-avg: %.2f ms  wait-max: %.2f ms\n",
+			_num_barriers, _barrier_waiters, _busy_shells,
+			avg, _barrier_wait_max_ms);
+	}
+	rc += buff;
+
+	{
+		std::lock_guard<std::mutex> lck(_recv_barrier_mtx);
+		double skew = 0 < _recv_barriers_done ?
+			_recv_skew_total_ms / _recv_barriers_done : 0.0;
+		double wait = 0 < _recv_waits ?
+			_recv_wait_total_ms / _recv_waits : 0.0;
+		snprintf(buff, sizeof(buff),
+			"cog-barrier: active: %zu  done: %zu  timed-out: %zu  skew-avg: %.1f ms  skew-max: %.1f ms  wait-avg: %.1f ms  wait-max: %.1f ms\n",
+			_recv_barriers.size(), _recv_barriers_done,
+			_recv_barriers_failed, skew, _recv_skew_max_ms,
+			wait, _recv_wait_max_ms);
+	}
+	rc += buff;
+
 	clock_t clk = clock();
 	int sec = clk / CLOCKS_PER_SEC;
 	clock_t rem = clk - sec * CLOCKS_PER_SEC;
@@ -167,10 +741,23 @@ std::string SocketManager::display_stats_full(const char* title, time_t start_ti
 		rus.ru_maxrss, rus.ru_majflt, rus.ru_inblock, rus.ru_oublock);
 	rc += buff;
 
-	// The above chews up 7 lines of display. Byobu/tmux needs a line.
-	// Blank line for accepting commands. So subtract 9.
+	{
+		std::lock_guard<std::mutex> lock(_stats_mtx);
+		for (const auto& pr : _stats_sources)
+			rc += pr.second();
+	}
+
+	// The above chews up a variable number of lines of display.
+	// Byobu/tmux needs a line. Blank line for accepting commands.
+	// So subtract two more.
+	// Negative nlines means unlimited, so don't let it go negative.
+	if (0 < nlines)
+	{
+		int nused = std::count(rc.begin(), rc.end(), '\n');
+		nlines = std::max(1, nlines - nused - 2);
+	}
 	rc += "\n";
-	rc += display_stats(nlines - 9);
+	rc += display_stats(nlines);
 
 	return rc;
 }
@@ -186,14 +773,11 @@ std::string SocketManager::display_stats(int nlines)
 	std::string rc;
 	rc.reserve(2000);
 
-	// Report under a lock so that sockets don't change while
-	// we access them.
-	std::lock_guard<std::mutex> lock(_sock_lock);
-
-	// Make a copy, and sort it.
-	std::vector<ServerSocket*> sov;
-	for (ServerSocket* ss : _sock_list)
-		sov.push_back(ss);
+	// Sockets listed in the snapshot won't be destroyed until we
+	// are done with it, so hold on to it until the end. Make a copy,
+	// and sort it.
+	auto snap = sockets();
+	std::vector<ServerSocket*> sov(*snap);
 
 	std::sort (sov.begin(), sov.end(),
 		[](ServerSocket* sa, ServerSocket* sb) -> bool
@@ -231,20 +815,26 @@ std::string SocketManager::display_stats(int nlines)
 // It's slightly cleaner.
 //
 // For websockets, this sends the pong frame, which has
-// the same effect.
+// the same effect. HTTP and MCP sockets are skipped: a stray
+// byte would land ahead of the next reply, and garble it.
 void SocketManager::half_ping(void)
 {
 	// static const char buf[2] = " ";
 	static const char buf[2] = {0x16, 0x0};
 
-	std::lock_guard<std::mutex> lock(_sock_lock);
 	time_t now = time(nullptr);
 
-	for (ServerSocket* ss : _sock_list)
+	// Hold the snapshot in a named local: the temporary in a range-for
+	// initializer would be destroyed before the loop body runs.
+	auto snap = sockets();
+	for (ServerSocket* ss : *snap)
 	{
 		// If the socket is waiting on input, and has been idle
 		// for more than ten seconds, then ping it to see if it
 		// is still alive.
+		if (ss->_is_mcp_socket or
+		    (ss->_is_http_socket and not ss->_do_frame_io))
+			continue;
 		if (ss->_status == ServerSocket::IWAIT and
 			now - ss->_last_activity > 10)
 		{
@@ -260,9 +850,8 @@ void SocketManager::half_ping(void)
 // TODO: should use std::jthread, once c++20 is widely available.
 bool SocketManager::kill(pid_t tid)
 {
-	std::lock_guard<std::mutex> lock(_sock_lock);
-
-	for (ServerSocket* ss : _sock_list)
+	auto snap = sockets();
+	for (ServerSocket* ss : *snap)
 	{
 		if (tid == ss->_tid)
 		{
@@ -283,120 +872,147 @@ void SocketManager::network_gone()
 {
 	_network_gone = true;
 
-	std::lock_guard<std::mutex> lock(_sock_lock);
-	for (ServerSocket* ss : _sock_list)
+	// Sockets still waiting for admission will never be started.
+	// Wait for the admission thread to finish starting any that it
+	// already dequeued, since it calls back into the NetworkServer.
+	std::vector<ServerSocket*> parked;
+	{
+		std::unique_lock<std::mutex> lck(_max_mtx);
+		for (Parked& pk : _admit_queue)
+			parked.push_back(pk.ss);
+		_admit_queue.clear();
+		_max_cv.wait(lck, [this] { return not _admitting; });
+	}
+	for (ServerSocket* ss : parked)
+		delete ss;
+
+	auto snap = sockets();
+	for (ServerSocket* ss : *snap)
 		ss->Exit();
 }
 
 // Wait for all shells to finish evaluating pending commands.
 // This provides a global barrier/fence for synchronization across
 // all clients and all connections.
+//
+// Shells report when they go busy or idle (see shell_busy()), so
+// there is no need to poll them; the barrier wakes up as soon as
+// the last of the other shells finishes its work.
 void SocketManager::global_barrier()
 {
-	// Find out which of these socekts is ourself.
-	ServerSocket* our_socket = nullptr;
-	{
-		std::lock_guard<std::mutex> lock(_sock_lock);
-		for (ServerSocket* ss : _sock_list)
-		{
-			ConsoleSocket* cs = dynamic_cast<ConsoleSocket*>(ss);
-			if (cs)
-			{
-				GenericShell* shell = cs->getShell();
-				if (shell and shell->is_eval_thread())
-				{
-					our_socket = ss;
-					break;
-				}
-			}
-		}
-	}
-	OC_ASSERT(nullptr != our_socket, "Barrier called out-of-band!");
+	// Find out which socket is ourself.
+	GenericShell* shell = GenericShell::current_shell();
+	OC_ASSERT(nullptr != shell, "Barrier called out-of-band!");
+	ServerSocket* our_socket = shell->get_socket();
 
 	our_socket->_in_barrier = true;
 	our_socket->_status = ServerSocket::BAR;
+	auto start = std::chrono::steady_clock::now();
 
-	// Set barrier active to block new work from being enqueued
-	{
-		std::lock_guard<std::mutex> lock(_global_barrier_mtx);
-		_global_barrier_active = true;
-	}
-
-	// Loop until all shells have drained thier work queues.
-	while (true)
-	{
-		bool all_idle = true;
-		{
-			std::lock_guard<std::mutex> lock(_sock_lock);
-			for (ServerSocket* ss : _sock_list)
-			{
-				if (ss == our_socket)
-					continue;
-
-				// There might be multiple concurrent bars. Avoid deadlock.
-				if (ss->_in_barrier)
-					continue;
-
-				ConsoleSocket* cs = dynamic_cast<ConsoleSocket*>(ss);
-				if (cs and cs->busyShell())
-				{
-					all_idle = false;
-					break;
-				}
-			}
-		}
-
-		if (all_idle)
-			break;
-
-		// Sleep briefly before checking again
-		usleep(10000); // 10ms
-	}
-
+	// Set barrier active to block new work from being enqueued.
+	// We are busy ourselves (running this very barrier), as are
+	// any other shells waiting in a barrier. There might be multiple
+	// concurrent bars; to avoid deadlock, don't wait on those.
+	std::unique_lock<std::mutex> lock(_global_barrier_mtx);
+	_global_barrier_active = true;
+	_barrier_waiters++;
+	_drain_cv.notify_all();
+	_drain_cv.wait(lock,
+		[this] { return _busy_shells <= _barrier_waiters; });
+	_barrier_waiters--;
 	our_socket->_in_barrier = false;
-	std::lock_guard<std::mutex> lock(_sock_lock);
-	for (ServerSocket* ss : _sock_list)
-		if (ss->_in_barrier) return;
+
+	double ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - start).count();
+	_num_barriers++;
+	_barrier_wait_total_ms += ms;
+	_barrier_wait_max_ms = std::max(_barrier_wait_max_ms, ms);
 
 	// Release barrier only if we are the last one out.
+	if (0 == _barrier_waiters)
 	{
-		std::lock_guard<std::mutex> lock(_global_barrier_mtx);
 		_global_barrier_active = false;
 		_global_barrier_cv.notify_all();
 	}
 }
 
+void SocketManager::shell_busy(bool busy)
+{
+	std::lock_guard<std::mutex> lock(_global_barrier_mtx);
+	if (busy)
+	{
+		_busy_shells++;
+		return;
+	}
+	_busy_shells--;
+	if (0 < _barrier_waiters and _busy_shells <= _barrier_waiters)
+		_drain_cv.notify_all();
+}
+
 // UUID-based barrier for multi-socket clients.
 // Blocks until all N sockets with the same UUID have called this,
 // then returns. No need to drain work queues because each socket
 // is on its eval thread, meaning all prior queued commands have
 // already been processed (the barrier command was dequeued last).
-void SocketManager::recv_barrier(uint8_t n, const std::string& uuid)
+bool SocketManager::recv_barrier(size_t n, const std::string& uuid,
+                                 unsigned int timeout_ms)
 {
+	auto now = std::chrono::steady_clock::now();
 	std::unique_lock<std::mutex> lock(_recv_barrier_mtx);
+	if (0 == timeout_ms) timeout_ms = _recv_barrier_timeout_ms;
 
 	auto it = _recv_barriers.find(uuid);
 	if (it == _recv_barriers.end()) {
 		// First arrival: expect n-1 more
-		it = _recv_barriers.try_emplace(uuid, n - 1, n).first;
-	} else {
-		it->second.remaining--;
+		it = _recv_barriers.try_emplace(uuid, n).first;
 	}
+	BarrierState& bs = it->second;
+	bs.to_exit++;
+	if (0 < bs.remaining) bs.remaining--;
 
-	if (it->second.remaining == 0 && !it->second.complete) {
+	if (bs.remaining == 0 && !bs.complete && !bs.failed) {
 		// Last to arrive - all N sockets are here, all prior work done
-		it->second.complete = true;
-		it->second.cv.notify_all();
+		bs.complete = true;
+		bs.cv.notify_all();
+
+		double skew = std::chrono::duration<double, std::milli>(
+			now - bs.first).count();
+		_recv_barriers_done++;
+		_recv_skew_total_ms += skew;
+		_recv_skew_max_ms = std::max(_recv_skew_max_ms, skew);
+	}
+
+	// Everyone waits until complete, or until the deadline passes.
+	// The deadline is counted from the first arrival, so that all
+	// waiters give up together.
+	auto done = [&bs] { return bs.complete or bs.failed; };
+	if (0 == timeout_ms)
+		bs.cv.wait(lock, done);
+	else if (not bs.cv.wait_until(lock,
+	             bs.first + std::chrono::milliseconds(timeout_ms), done))
+	{
+		bs.failed = true;
+		bs.cv.notify_all();
+		_recv_barriers_failed++;
+		logger().warn("[SocketManager] cog-barrier \"%s\" timed out "
+			"with %zu of %zu sockets missing",
+			uuid.c_str(), bs.remaining, n);
 	}
+	bool ok = bs.complete;
 
-	// Everyone waits until complete
-	while (!it->second.complete)
-		it->second.cv.wait(lock);
+	double ms = std::chrono::duration<double, std::milli>(
+		std::chrono::steady_clock::now() - now).count();
+	_recv_waits++;
+	_recv_wait_total_ms += ms;
+	_recv_wait_max_ms = std::max(_recv_wait_max_ms, ms);
 
-	// Everyone exits; last one cleans up
-	it->second.to_exit--;
-	if (it->second.to_exit == 0)
+	// Everyone exits; last one cleans up. A failed barrier is
+	// forgotten once its waiters are gone; stragglers arriving
+	// after that start a new one, and time out on their own.
+	bs.to_exit--;
+	if (bs.to_exit == 0 and (bs.complete or bs.failed))
 		_recv_barriers.erase(it);
+	return ok;
 }
 
 /// Prevent shells from enqueueing new work.
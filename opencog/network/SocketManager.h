@@ -8,11 +8,21 @@
 #ifndef _OPENCOG_SOCKET_MANAGER_H
 #define _OPENCOG_SOCKET_MANAGER_H
 
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
 #include <mutex>
 #include <set>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <opencog/network/OutputDispatcher.h>
 
 namespace opencog
 {
@@ -30,12 +40,27 @@ class GenericShell;
 class SocketManager
 {
 	friend class ServerSocket;
-	friend class GenericShell;   // Calls block_on_bar()
+	friend class GenericShell;   // Calls block_on_bar(), shell_busy()
 
 private:
-	// Socket registry
+	// Socket registry. Readers (stats, pings, kill) take a snapshot
+	// with an atomic load, and never block. Writers (connect and
+	// disconnect) publish a modified copy under _sock_lock. Each
+	// snapshot gets a generation number, and is listed in _live_snaps
+	// until the last reader drops it. Before a socket is destroyed,
+	// rem_sock() waits until every snapshot older than the one that
+	// dropped it is gone; the snapshot deleter signals _rcu_cv when
+	// one goes.
+	typedef std::vector<ServerSocket*> SockList;
 	std::mutex _sock_lock;
-	std::set<ServerSocket*> _sock_list;
+	uint64_t _snap_gen;                // Guarded by _sock_lock
+	std::mutex _rcu_mtx;
+	std::condition_variable _rcu_cv;
+	std::set<uint64_t> _live_snaps;    // Guarded by _rcu_mtx
+	std::shared_ptr<const SockList> _sock_snap;
+	uint64_t publish(SockList*);
+	std::shared_ptr<const SockList> sockets() const
+	{ return std::atomic_load(&_sock_snap); }
 
 	// Connection limiting
 	unsigned int _max_open_sockets;
@@ -44,21 +69,113 @@ private:
 	std::condition_variable _max_cv;
 	size_t _num_open_stalls;
 
+	// Adaptive limit on open sockets; see set_adaptive_limit().
+	// Eval latency is reported by the shells, and smoothed; the
+	// baseline is the lowest latency seen recently. Guarded by
+	// _max_mtx, except for the latency, which has its own lock.
+	std::thread* _limit_thread;
+	bool _limit_stop;
+	unsigned int _limit_min;
+	unsigned int _limit_max;
+	std::deque<unsigned int> _limit_history;
+	std::mutex _lat_mtx;
+	double _lat_ewma_ms;
+	double _lat_base_ms;
+	size_t _lat_samples;
+	unsigned int _runq;
+	void limit_loop(void);
+
+	// Admission control. Connections that arrive when all slots are
+	// taken are parked here, until a slot frees up, or until they've
+	// waited too long. If the queue is full, they are turned away.
+	struct Parked {
+		ServerSocket* ss;
+		std::chrono::steady_clock::time_point since;
+		std::function<void(ServerSocket*)> start;
+	};
+	std::deque<Parked> _admit_queue;
+	size_t _admit_depth;
+	unsigned int _admit_deadline_ms;   // Zero means wait forever
+	std::thread* _admit_thread;
+	bool _admit_stop;
+	bool _admitting;       // Admission thread is starting sockets
+	size_t _num_rejected;
+	size_t _num_admit_waits;
+	double _admit_wait_total_ms;
+	double _admit_wait_max_ms;
+	void admit_loop(void);
+
 	// Barrier synchronization (for global_barrier)
 	std::mutex _global_barrier_mtx;
 	std::condition_variable _global_barrier_cv;
 	bool _global_barrier_active;
 
+	// Shells with queued or running work, and how many of those
+	// are themselves sitting in global_barrier(). The barrier is
+	// done when every busy shell is one of the waiters.
+	std::condition_variable _drain_cv;
+	size_t _busy_shells;
+	size_t _barrier_waiters;
+	size_t _num_barriers;
+	double _barrier_wait_total_ms;
+	double _barrier_wait_max_ms;
+
 	// UUID-based barrier tracking (for recv_barrier)
 	struct BarrierState {
-		uint8_t remaining;    // Counts down as sockets arrive
-		uint8_t to_exit;      // Counts down as sockets exit (for cleanup)
+		size_t remaining;     // Counts down as sockets arrive
+		size_t to_exit;       // Counts down as sockets exit (for cleanup)
 		bool complete;
+		bool failed;          // Deadline passed before all arrived
+		std::chrono::steady_clock::time_point first;  // First arrival
 		std::condition_variable cv;
-		BarrierState(uint8_t r, uint8_t e) : remaining(r), to_exit(e), complete(false) {}
+		BarrierState(size_t r) : remaining(r), to_exit(0),
+			complete(false), failed(false),
+			first(std::chrono::steady_clock::now()) {}
 	};
 	std::unordered_map<std::string, BarrierState> _recv_barriers;
 	std::mutex _recv_barrier_mtx;
+	unsigned int _recv_barrier_timeout_ms;  // Zero means wait forever
+	size_t _recv_barriers_done;
+	size_t _recv_barriers_failed;
+	double _recv_skew_total_ms;   // First to last arrival
+	double _recv_skew_max_ms;
+	size_t _recv_waits;
+	double _recv_wait_total_ms;
+	double _recv_wait_max_ms;
+
+	// Deadline flushes for batched socket output.
+	std::mutex _flush_mtx;
+	std::condition_variable _flush_cv;
+	std::multimap<std::chrono::steady_clock::time_point, ServerSocket*> _flush_due;
+	ServerSocket* _flushing;
+	std::thread* _flush_thread;
+	bool _flush_stop;
+	void flush_loop(void);
+
+	// Idle-connection reaper. Timeouts are in seconds, per socket
+	// kind (telnet, http, websocket, MCP); zero means never.
+	std::mutex _reaper_mtx;
+	std::condition_variable _reaper_cv;
+	std::thread* _reaper_thread;
+	bool _reaper_stop;
+	unsigned int _idle_secs[4];
+	size_t _num_reaped[4];
+	void reaper_loop(void);
+	static int kind_index(char);
+
+	// TCP keepalive, applied to each new connection. Zero idle time
+	// means keepalive is not enabled.
+	unsigned int _ka_idle;
+	unsigned int _ka_intvl;
+	unsigned int _ka_count;
+
+	// Additional lines for display_stats_full(), e.g. per-listener
+	// stats. Keyed by the owner, so that they can be removed again.
+	std::mutex _stats_mtx;
+	std::vector<std::pair<const void*, std::function<std::string()>>> _stats_sources;
+
+	// Forwards evaluator output to sockets, for all shells.
+	OutputDispatcher _output_dispatcher;
 
 	// Global flags
 	bool _network_gone;
@@ -71,23 +188,79 @@ protected:
 	// Methods for ServerSocket (friend class) to manage its lifecycle
 	void add_sock(ServerSocket*);
 	void rem_sock(ServerSocket*);
-	void wait_available_slot();
 	void release_slot();
 	bool is_network_gone() const { return _network_gone; }
 
+	// Set TCP keepalive options on a newly-connected socket.
+	void set_keepalive_opts(int fd);
+
+	// Flush the output batch of the socket after `usec` microsecs.
+	void schedule_flush(ServerSocket*, unsigned int usec);
+	void cancel_flush(ServerSocket*);
+
 	// Bar shells from enqueueing new work.
 	void block_on_bar();
 
+	// Shells report going from idle to busy, and back.
+	void shell_busy(bool);
+
+	// Shells report how long each evaluation took.
+	void record_latency(double ms);
+
 public:
 	SocketManager();
 	~SocketManager();
 
+	OutputDispatcher* get_output_dispatcher() { return &_output_dispatcher; }
+
 	// Configuration
-	void set_max_open_sockets(unsigned int m) { _max_open_sockets = m; }
+	void set_max_open_sockets(unsigned int);
+
+	/**
+	 * Let the limit on open sockets float between `min` and `max`,
+	 * adjusted once a second: additive increase while connections
+	 * are waiting for a slot, multiplicative decrease when eval
+	 * latency climbs well above its baseline, or when there are more
+	 * runnable threads than CPUs. A zero `max` turns this off.
+	 */
+	void set_adaptive_limit(unsigned int min, unsigned int max);
+	void set_admission_queue(size_t depth, unsigned int deadline_ms);
+	void set_barrier_timeout(unsigned int ms);
+
+	/**
+	 * Close sockets of the given kind (`T` telnet, `H` http
+	 * keep-alive, `W` websocket, `M` MCP) that have been waiting for
+	 * input, with nothing queued or running, for more than `secs`
+	 * seconds. Zero disables. A background thread checks once a
+	 * second, and also pings idle sockets to flush out dead ones.
+	 */
+	void set_idle_timeout(char kind, unsigned int secs);
+
+	/// TCP keepalive for new connections: idle time before the first
+	/// probe, interval between probes, and number of probes, in secs.
+	void set_keepalive(unsigned int idle, unsigned int intvl,
+	                   unsigned int count);
+
+	/**
+	 * Admission control for a newly-accepted connection. If there is
+	 * a free slot, then `start` is called right away. Otherwise, the
+	 * socket is parked in the admission queue, and `start` is called
+	 * later, from the admission thread, when a slot frees up. If the
+	 * queue is full, or if the socket has waited longer than the
+	 * deadline, it is sent a "server busy" reply and deleted.
+	 * This never blocks; the listener remains free to accept.
+	 */
+	void admit(ServerSocket*, std::function<void(ServerSocket*)> start);
 
 	// Network status control - closes all sockets so handler threads can exit
 	void network_gone();
 
+	// Register a callback that returns extra lines of text to be
+	// printed in the header of display_stats_full(). Each line
+	// must be newline-terminated.
+	void add_stats_source(const void* owner, std::function<std::string()>);
+	void rem_stats_source(const void* owner);
+
 	// Public socket operations
 	std::string display_stats_full(const char* title, time_t start_time, int nlines = -1);
 	bool kill(pid_t tid);
@@ -108,10 +281,15 @@ public:
 	 * UUID-based barrier for multi-socket clients. Each client sends
 	 * (cog-barrier N "uuid") on all N of its sockets. This method
 	 * blocks until all N arrivals for the given UUID are received,
-	 * then returns. No work queue draining needed since callers are
-	 * on their eval threads (prior queued work already completed).
+	 * then returns true. No work queue draining needed since callers
+	 * are on their eval threads (prior queued work already completed).
+	 *
+	 * If not all N have arrived within `timeout_ms` of the first
+	 * arrival, all waiters return false. A zero timeout means the
+	 * default set with set_barrier_timeout(), if any.
 	 */
-	void recv_barrier(uint8_t n, const std::string& uuid);
+	bool recv_barrier(size_t n, const std::string& uuid,
+	                  unsigned int timeout_ms = 0);
 };
 
 } // namespace
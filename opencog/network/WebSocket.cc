@@ -9,141 +9,231 @@
 // key. It is not used for anything else.
 #ifdef HAVE_OPENSSL
 
+#include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <openssl/sha.h>
 
 #include <opencog/util/exceptions.h>
 #include <opencog/util/Logger.h>
 
+#include "Compress.h"
 #include "ServerSocket.h"
 
 using namespace opencog;
 
+// Messages shorter than this are sent uncompressed, even when
+// permessage-deflate is on; it would not save anything.
+static constexpr size_t deflate_min = 256;
+
+// Limit on the size of a message that arrives in fragments, or that
+// is compressed. Anything that reassembles or inflates to more than
+// this is refused; in the latter case, it is likely a zip bomb.
+static constexpr size_t message_max = 64 * 1024 * 1024;
+
+// Messages longer than this are sent in fragments of this size, so
+// that the client can start on a large result before all of it has
+// arrived.
+static constexpr size_t fragment_size = 1024 * 1024;
+
 // ==================================================================
 
-/// Read from the websocket, decoding all framing and control bits,
-/// and return the text data as a string. This returns one frame
-/// at a time. No attempt is made to consolidate fragments.
-std::string ServerSocket::get_websocket_line()
+/// Extract one websocket message from the receive buffer, decoding
+/// all framing and control bits, and return the data. The data is
+/// unmasked in place. A message that came in a single frame is
+/// returned as a view into the receive buffer; a fragmented one is
+/// reassembled into _ws_message. Pings are answered, and pongs
+/// ignored, in passing; these may arrive between fragments.
+/// _ws_binary is set if the message was sent as binary data.
+/// Returns false if the buffer does not yet hold a complete message.
+bool ServerSocket::extract_websocket(std::string_view& blob)
 {
-	// If we are here, then we are expecting a frame header.
-	// Get frame and opcode
-	unsigned char fop;
-	asio::read(*_socket, asio::buffer(&fop, 1));
-
-	// bool finbit = fop & 0x80;
-	unsigned char opcode = fop & 0xf;
+	// The last message has been handled by now. Don't hang on to
+	// the memory used for an unusually large one.
+	if (not _ws_fragmented and fragment_size < _ws_message.capacity())
+		std::string().swap(_ws_message);
 
-	// Handle pings
-	while (9 == opcode or 0xa == opcode)
+	while (true)
 	{
-		std::string pingd = get_websocket_data();
+		unsigned char* hdr = (unsigned char*) _rx_buf.data() + _rx_start;
+		size_t avail = _rx_end - _rx_start;
 
-		// If ping, send a pong, copying the data.
-		if (9 == opcode)
+		// If we are here, then we are expecting a frame header.
+		// Get frame and opcode, mask and payload length.
+		if (avail < 2) return false;
+
+		bool finbit = hdr[0] & 0x80;
+		bool compressed = hdr[0] & 0x40;   // RSV1; see RFC 7692
+		unsigned char opcode = hdr[0] & 0xf;
+		bool maskbit = hdr[1] & 0x80;
+		uint64_t paylen = hdr[1] & 0x7f;
+		size_t hlen = 2;
+
+		if (126 == paylen)
 		{
-			size_t paylen = pingd.size();
-			char header[2];
-			header[0] = 0x8a;
-			header[1] = (char) paylen;
-			Send(asio::const_buffer(header, 2));
-			if (0 < paylen)
-				Send(asio::const_buffer(pingd.data(), paylen));
+			if (avail < 4) return false;
+			paylen = (((uint64_t) hdr[2]) << 8) | hdr[3];
+			hlen = 4;
+		}
+		else if (127 == paylen)
+		{
+			if (avail < 10) return false;
+			paylen = 0;
+			for (int k=2; k<10; k++)
+				paylen = (paylen << 8) | hdr[k];
+			if ((1UL << 40) < paylen)
+			{
+				logger().warn("Websocket insane length %lu\n", paylen);
+				throw SilentException();
+			}
+			hlen = 10;
 		}
 
-		// And wait for the next frame...
-		asio::read(*_socket, asio::buffer(&fop, 1));
-		// finbit = fop & 0x80;
-		opcode = fop & 0xf;
-	}
+		// It is an error if the maskbit is not set. Bail out.
+		if (not maskbit)
+		{
+			logger().warn("WebSocket received unmasked data!");
+			throw SilentException();
+		}
 
-	// Socket close message .. just quit.
-	if (8 == opcode)
-	{
-		logger().info("Received WebSocket close");
-		throw SilentException();
-	}
+		// Control frames are short, and never fragmented.
+		if ((opcode & 0x8) and (not finbit or 125 < paylen))
+		{
+			logger().warn("WebSocket received bad control frame");
+			throw SilentException();
+		}
 
-	// We only support text data.
-	if (1 != opcode)
-	{
-		logger().warn("Not expecting binary websocket data; opcode=%d",
-			opcode);
-		throw SilentException();
-	}
+		// Don't wait for a frame that would not be accepted anyway,
+		// whether it is a whole message, or a fragment of one.
+		size_t have = (0 == opcode) ? _ws_message.size() : 0;
+		if (not (opcode & 0x8) and message_max - have < paylen)
+		{
+			logger().warn("WebSocket message too long");
+			send_websocket_close(1009);
+			throw SilentException();
+		}
 
-	return get_websocket_data();
-}
+		// Wait for the mask, and the full payload.
+		if (avail < hlen + 4 + paylen) return false;
 
-/// Read from the websocket, decoding the length and data.
-/// Assumes the opcode has already been read.
-/// Return the text data as a string. This returns one frame
-/// at a time. No attempt is made to consolidate fragments.
-std::string ServerSocket::get_websocket_data(void)
-{
-	// Mask and payload length
-	unsigned char mpay;
-	asio::read(*_socket, asio::buffer(&mpay, 1));
-	bool maskbit = mpay & 0x80;
-	int8_t paybyte = mpay & 0x7f;
-	int64_t paylen = paybyte;
-
-	if (126 == paybyte)
-	{
-		uint16_t shore;
-		asio::read(*_socket, asio::buffer(&shore, 2));
-		paylen = ntohs(shore);
-	}
-	else if (127 == paybyte)
-	{
-		uint32_t lunglo, lunghi;
-		asio::read(*_socket, asio::buffer(&lunghi, 4));
-		asio::read(*_socket, asio::buffer(&lunglo, 4));
-		uint64_t lung = ntohl(lunghi);
-		lung = lung << 32 | ntohl(lunglo);
-		if ((1UL << 40) < lung)
+		uint32_t mask;
+		memcpy(&mask, hdr + hlen, 4);
+		char* data = (char*) hdr + hlen + 4;
+		consume_rx(hlen + 4 + paylen);
+
+		// Bulk unmask the data, using XOR.
+		uint64_t i=0;
+		for (; i+4 <= paylen; i += 4)
 		{
-			logger().warn("Websocket insane length %lu\n", lung);
-			throw SilentException();
+			uint32_t w;
+			memcpy(&w, data+i, 4);
+			w ^= mask;
+			memcpy(data+i, &w, 4);
 		}
-		paylen = lung;
-	}
 
-	// It is an error if the maskbit is not set. Bail out.
-	if (not maskbit)
-	{
-		logger().warn("WebSocket received unmasked data!");
-		throw SilentException();
-	}
+		// Unmask any remaining bytes.
+		for (unsigned int j=0; j<paylen%4; j++)
+			data[i+j] = data[i+j] ^ ((mask >> (8*j)) & 0xff);
+
+		blob = std::string_view(data, paylen);
 
-	uint32_t mask;
-	asio::read(*_socket, asio::buffer(&mask, 4));
+		// If ping, send a pong, copying the data. Then wait for the
+		// next frame... The pong may go out between the fragments of
+		// a message that is being sent, but not in the middle of one.
+		if (9 == opcode)
+		{
+			char header[2];
+			header[0] = 0x8a;
+			header[1] = (char) paylen;
+			std::lock_guard<std::mutex> lock(_ws_send_mtx);
+			Send({asio::const_buffer(header, 2),
+			      asio::const_buffer(data, paylen)});
+			continue;
+		}
+		if (0xa == opcode)
+			continue;
 
-	// Use malloc inside of std::string to get a buffer.
-	std::string blob;
-	blob.resize(paylen);
-	char* data = blob.data();
-	asio::read(*_socket, asio::buffer(data, paylen));
+		// Socket close message .. just quit.
+		if (8 == opcode)
+		{
+			logger().info("Received WebSocket close");
+			throw SilentException();
+		}
 
-	// Bulk unmask the data, using XOR.
-	uint32_t *dp = (uint32_t *) data;
-	int64_t i=0;
-	while (i <= paylen-4)
-	{
-		*dp = *dp ^ mask;
-		++dp;
-		i += 4;
-	}
+		// Text, binary, and the continuation of either.
+		if (2 < opcode)
+		{
+			logger().warn("Unknown websocket opcode=%d", opcode);
+			throw SilentException();
+		}
 
-	// Unmask any remaining bytes.
-	for (unsigned int j=0; j<paylen%4; j++)
-		data[i+j] = data[i+j] ^ ((mask >> (8*j)) & 0xff);
+		// The first frame of a message says what kind it is, and
+		// whether it is compressed; continuation frames say neither.
+		if (0 == opcode)
+		{
+			if (not _ws_fragmented or compressed)
+			{
+				logger().warn("WebSocket received bad continuation frame");
+				throw SilentException();
+			}
+			_ws_message.append(data, paylen);
+			if (not finbit) continue;
+			_ws_fragmented = false;
+			compressed = _ws_msg_compressed;
+			blob = _ws_message;
+		}
+		else
+		{
+			if (_ws_fragmented)
+			{
+				logger().warn("WebSocket message interrupted by another");
+				throw SilentException();
+			}
+			_ws_binary = (2 == opcode);
+			if (not finbit)
+			{
+				_ws_fragmented = true;
+				_ws_msg_compressed = compressed;
+				_ws_message.assign(data, paylen);
+				continue;
+			}
+		}
 
-	// We're not actually going to use a line protocol, when we're
-	// using websockets. If the user wants to search for newline
-	// chars in the datastream, they are welcome to. We're not
-	// going to futz with that.
-	return blob;
+		// A compressed message. The sender stripped the four bytes
+		// that end a deflate flush block; put them back.
+		if (compressed)
+		{
+#ifdef HAVE_ZLIB
+			static const char tail[4] = {0, 0, (char) 0xff, (char) 0xff};
+			if (nullptr == _ws_inflater)
+			{
+				logger().warn("WebSocket compression was not negotiated");
+				throw SilentException();
+			}
+			_ws_inflated.clear();
+			bool ok = _ws_inflater->decompress(blob.data(), blob.size(),
+			                                   _ws_inflated, message_max) and
+			          _ws_inflater->decompress(tail, 4,
+			                                   _ws_inflated, message_max);
+			_ws_inflater->reset();
+			if (not ok)
+			{
+				logger().warn("WebSocket received bad compressed data");
+				throw SilentException();
+			}
+			blob = _ws_inflated;
+#else
+			logger().warn("WebSocket compression was not negotiated");
+			throw SilentException();
+#endif
+		}
+
+		// We're not actually going to use a line protocol, when we're
+		// using websockets. If the user wants to search for newline
+		// chars in the datastream, they are welcome to. We're not
+		// going to futz with that.
+		return true;
+	}
 }
 
 /// Send a WebSocket pong message.
@@ -152,44 +242,176 @@ void ServerSocket::send_websocket_pong()
 	char header[2];
 	header[0] = 0x8a;
 	header[1] = 0;
+	std::lock_guard<std::mutex> lock(_ws_send_mtx);
 	Send(asio::const_buffer(header, 2));
 }
 
-/// Send string via websocket, performing framing.
-void ServerSocket::send_websocket(const std::string& cmd)
+/// Send a WebSocket close message, with a status code (RFC 6455,
+/// section 7.4).
+void ServerSocket::send_websocket_close(uint16_t code)
 {
-    // Send only one packet, and indicate it's length.
-    size_t paylen = cmd.size();
-    char header[10];
-    header[0] = 0x81;
+	char frame[4];
+	frame[0] = (char) 0x88;
+	frame[1] = 2;
+	frame[2] = (code >> 8) & 0xff;
+	frame[3] = code & 0xff;
+	std::lock_guard<std::mutex> lock(_ws_send_mtx);
+	Send(asio::const_buffer(frame, 4));
+}
+
+/// Write a frame header for a frame with the given first byte (the
+/// FIN and RSV bits, and the opcode) and payload length. Returns the
+/// length of the header; the buffer must hold at least 10 bytes.
+static size_t frame_header(char* header, unsigned char opbyte,
+                           size_t paylen)
+{
+    header[0] = opbyte;
     if (paylen < 126)
     {
         header[1] = (char) paylen;
-        Send(asio::const_buffer(header, 2));
+        return 2;
     }
-    else if (paylen < 65536)
+    if (paylen < 65536)
     {
         header[1] = 126;
         header[2] = (paylen >> 8) & 0xff;
         header[3] = paylen & 0xff;
-        Send(asio::const_buffer(header, 4));
+        return 4;
+    }
+    header[1] = 127;
+    header[2] = (paylen >> 56) & 0xff;
+    header[3] = (paylen >> 48) & 0xff;
+    header[4] = (paylen >> 40) & 0xff;
+    header[5] = (paylen >> 32) & 0xff;
+    header[6] = (paylen >> 24) & 0xff;
+    header[7] = (paylen >> 16) & 0xff;
+    header[8] = (paylen >> 8) & 0xff;
+    header[9] = paylen & 0xff;
+    return 10;
+}
+
+/// Send string via websocket, performing framing. If permessage-deflate
+/// was negotiated, longer messages are compressed. Very long messages
+/// are sent in several fragments.
+void ServerSocket::send_websocket(const std::string& cmd, bool binary)
+{
+    const char* payload = cmd.c_str();
+    size_t paylen = cmd.size();
+    unsigned char opbyte = binary ? 0x2 : 0x1;
+
+    // The fragments of one message must not be interleaved with
+    // those of another, sent from some other thread.
+    std::lock_guard<std::mutex> lock(_ws_send_mtx);
+
+#ifdef HAVE_ZLIB
+    std::string zipped;
+    if (_ws_deflater and deflate_min <= paylen)
+    {
+        _ws_deflater->compress(payload, paylen, zipped, true);
+        _ws_deflater->reset();
+
+        // The flush always ends with 00 00 ff ff; RFC 7692 says to
+        // leave that off.
+        zipped.resize(zipped.size() - 4);
+        payload = zipped.c_str();
+        paylen = zipped.size();
+        opbyte |= 0x40;
     }
-    else
+#endif
+
+    // Send the header and the actual data in one go, for each
+    // fragment. Only the first one carries the opcode and the
+    // compression bit; the rest are continuation frames.
+    char header[10];
+    while (fragment_size < paylen)
     {
-        header[1] = 127;
-        header[2] = (paylen >> 56) & 0xff;
-        header[3] = (paylen >> 48) & 0xff;
-        header[4] = (paylen >> 40) & 0xff;
-        header[5] = (paylen >> 32) & 0xff;
-        header[6] = (paylen >> 24) & 0xff;
-        header[7] = (paylen >> 16) & 0xff;
-        header[8] = (paylen >> 8) & 0xff;
-        header[9] = paylen & 0xff;
-        Send(asio::const_buffer(header, 10));
+        size_t hlen = frame_header(header, opbyte, fragment_size);
+        Send({asio::const_buffer(header, hlen),
+              asio::const_buffer(payload, fragment_size)});
+        payload += fragment_size;
+        paylen -= fragment_size;
+        opbyte = 0x0;
     }
 
-    // Send the actual data.
-    Send(asio::const_buffer(cmd.c_str(), paylen));
+    size_t hlen = frame_header(header, opbyte | 0x80, paylen);
+    Send({asio::const_buffer(header, hlen),
+          asio::const_buffer(payload, paylen)});
+}
+
+/// Accept the permessage-deflate extension, if the client offered
+/// it, and set up for it. Returns the extension to put into the
+/// handshake reply, or an empty string, if there is none.
+std::string ServerSocket::negotiate_deflate(void)
+{
+#ifdef HAVE_ZLIB
+    // The client may make several offers, separated by commas; take
+    // the first one that we can do. Each is the extension name,
+    // followed by parameters, separated by semicolons.
+    std::string_view offers(_ws_extensions);
+    while (not offers.empty())
+    {
+        size_t comma = offers.find(',');
+        std::string_view offer = offers.substr(0, comma);
+        offers.remove_prefix(std::string_view::npos == comma ?
+                             offers.size() : comma + 1);
+
+        bool first = true;
+        bool usable = true;
+        int server_bits = 15;
+        bool server_bits_asked = false;
+        while (usable and not offer.empty())
+        {
+            size_t semi = offer.find(';');
+            std::string_view param = offer.substr(0, semi);
+            offer.remove_prefix(std::string_view::npos == semi ?
+                                offer.size() : semi + 1);
+            while (not param.empty() and ' ' == param.front())
+                param.remove_prefix(1);
+            while (not param.empty() and ' ' == param.back())
+                param.remove_suffix(1);
+
+            std::string_view value;
+            size_t eq = param.find('=');
+            if (std::string_view::npos != eq)
+            {
+                value = param.substr(eq + 1);
+                param = param.substr(0, eq);
+                if (not value.empty() and '"' == value.front())
+                    value = value.substr(1, value.size() - 2);
+            }
+
+            if (first)
+                usable = ("permessage-deflate" == param);
+            else if ("server_max_window_bits" == param)
+            {
+                // zlib can't do raw deflate with a window of 2^8.
+                server_bits = atoi(std::string(value).c_str());
+                server_bits_asked = true;
+                usable = (9 <= server_bits and server_bits <= 15);
+            }
+            else if ("server_no_context_takeover" != param and
+                     "client_no_context_takeover" != param and
+                     "client_max_window_bits" != param)
+                usable = false;
+            first = false;
+        }
+        if (not usable) continue;
+
+        // We always reset our compressor after each message, and ask
+        // the client to do the same, so that no connection has to
+        // keep a compression window around between messages.
+        _ws_deflater = new Deflater(Deflater::RAW, Z_DEFAULT_COMPRESSION,
+                                    server_bits);
+        _ws_inflater = new Inflater(15);
+
+        std::string reply = "permessage-deflate; "
+            "server_no_context_takeover; client_no_context_takeover";
+        if (server_bits_asked)
+            reply += "; server_max_window_bits=" + std::to_string(server_bits);
+        return reply;
+    }
+#endif // HAVE_ZLIB
+    return "";
 }
 
 // ==================================================================
@@ -219,80 +441,15 @@ static std::string base64_encode(unsigned char* buf, int len)
 	return out;
 }
 
-/// Process the HTTP header and optionally perform the websockets
-/// handshake. That is, listen for the HTTP header, and pick through
-/// the various fields in it. If it has an `Upgrade: websocket` line in
-/// it, then upgrade to websockets i.e. perform the magic-key exchange,
-/// etc. Upon upgrade, the socket is ready to send and receive websocket
-/// frames. Otherwise, treat the socket as an ordinary telnet-like
-/// socket, with keep-alive set. In either case, the remaining I/O gets
-/// routed to some shell handler, depending on the URL.
-void ServerSocket::HandshakeLine(const std::string& line)
+/// Act on a parsed HTTP request header, and optionally perform the
+/// websockets handshake. If the header has an `Upgrade: websocket`
+/// field in it, then upgrade to websockets i.e. perform the magic-key
+/// exchange, etc. Upon upgrade, the socket is ready to send and
+/// receive websocket frames. Otherwise, the request body follows,
+/// and after it, possibly more requests. In either case, the remaining
+/// I/O gets routed to some shell handler, depending on the URL.
+void ServerSocket::Handshake(void)
 {
-	// The very first HTTP line.
-	if (not _got_first_line)
-	{
-		_got_first_line = true;
-
-		if (0 == line.compare(0, 4, "GET "))
-		{
-			_url = line.substr(4, line.find(" ", 4) - 4);
-		}
-		else if (0 == line.compare(0, 5, "POST "))
-		{
-			_url = line.substr(5, line.find(" ", 5) - 5);
-		}
-		else
-		{
-			Send("HTTP/1.1 501 Not Implemented\r\n"
-				"Server: CogServer\r\n"
-				"\r\n");
-			throw SilentException();
-		}
-		return;
-	}
-
-	// If the line-size is zero, then we've reached the end of
-	// header sent by the client.
-	if (not _got_http_header and 0 == line.size())
-	{
-		_got_http_header = true;
-	}
-
-	// Extract stuff from the header the client is sending us.
-	if (not _got_http_header)
-	{
-		static const char* CLen = "Content-Length: ";
-		if (0 == line.compare(0, strlen(CLen), CLen))
-			{ _content_length = std::stoi(line.substr(strlen(CLen))); return; }
-
-		static const char* clen = "content-length: ";
-		if (0 == line.compare(0, strlen(clen), clen))
-			{ _content_length = std::stoi(line.substr(strlen(clen))); return; }
-
-		static const char* host = "Host: ";
-		if (0 == line.compare(0, strlen(host), host))
-			{ _host_header = line.substr(strlen(host)); return; }
-
-		static const char* host_lower = "host: ";
-		if (0 == line.compare(0, strlen(host_lower), host_lower))
-			{ _host_header = line.substr(strlen(host_lower)); return; }
-
-		static const char* kpal = "connection: keep-alive";
-		if (0 == line.compare(0, strlen(kpal), kpal))
-			{ _keep_alive = true; return; }
-
-		static const char* upg = "Upgrade: websocket";
-		if (0 == line.compare(0, strlen(upg), upg))
-			{ _got_websock_header = true; return; }
-
-		static const char* key = "Sec-WebSocket-Key: ";
-		if (0 == line.compare(0, strlen(key), key))
-			{ _webkey = line.substr(strlen(key)); return; }
-
-		return;
-	}
-
 	// If we are here, then the full HTTP header was received. This
 	// is enough to get started: call the user's OnConnection()
 	// method. The user is supposed to handle the rest:
@@ -325,9 +482,16 @@ void ServerSocket::HandshakeLine(const std::string& line)
 		"Connection: Upgrade\r\n"
 		"Sec-WebSocket-Accept: ";
 	response += b64hash;
-	response +=
-		"\r\n"
-		"\r\n";
+	response += "\r\n";
+
+	std::string ext = negotiate_deflate();
+	if (not ext.empty())
+	{
+		response += "Sec-WebSocket-Extensions: ";
+		response += ext;
+		response += "\r\n";
+	}
+	response += "\r\n";
 
 	Send(response);
 